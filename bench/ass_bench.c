@@ -0,0 +1,173 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - ass_bench.c
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ *
+ * Microbenchmark of the ASS writer on its own: the events of a large
+ * synthetic file formatted with stdio, as the writer used to, and with
+ * the output buffer, then written out to a file. Documents are rendered
+ * without an analyzer, so MeCab is never run and only formatting and
+ * output are measured. The two renderings are checked to be identical.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ass.h"
+#include "types.h"
+#include "utils.h"
+#include "mem.h"
+
+#define CUES		100000
+#define ROUNDS		5
+
+static const char *const lines[] = {
+	"日本語の字幕です", "そうですね！", "Opening theme",
+	"今日はいい天気ですね", "えっ、本当？", "ありがとう"
+};
+
+static struct subtitle *make_cues(int count)
+{
+	struct subtitle *subs = malloc(count * sizeof(struct subtitle));
+	int i;
+
+	if (!subs)
+		return NULL;
+
+	/* Single-line cues that do not share timing with anything */
+	for (i = 0; i < count; i++) {
+		subs[i].start_ms = i * 2500;
+		subs[i].end_ms = i * 2500 + 2300;
+		subs[i].text = lines[i % 6];
+		subs[i].len = strlen(lines[i % 6]);
+	}
+	return subs;
+}
+
+/* The events as stdio formatted them, for single-line cues */
+static void render_stdio(FILE *f, const struct subtitle *subs, int count,
+			 const struct font_config *cfg)
+{
+	char ts[MAX_TIME], te[MAX_TIME];
+	int i;
+
+	for (i = 0; i < count; i++) {
+		int ms[2] = { subs[i].start_ms, subs[i].end_ms };
+		char *out[2] = { ts, te };
+		int k;
+
+		for (k = 0; k < 2; k++) {
+			int t = ms[k];
+
+			snprintf(out[k], MAX_TIME, "%d:%02d:%02d.%02d",
+				 t / MS_PER_HOUR, t % MS_PER_HOUR /
+				 MS_PER_MINUTE, t % MS_PER_MINUTE /
+				 MS_PER_SECOND, t % MS_PER_SECOND / 10);
+		}
+
+		fprintf(f, "Dialogue: 0,%s,%s,Main,,0,0,0,,"
+			   "{\\pos(%.1f,%d)\\an5}%.*s\n",
+			ts, te, cfg->screen_w / 2.0f, cfg->baseline_y,
+			(int)subs[i].len, subs[i].text);
+	}
+}
+
+static size_t render_outbuf(struct ass_doc *doc)
+{
+	size_t total = 0;
+	int i;
+
+	for (i = 0; i < doc->nchunks; i++) {
+		mem_free(doc->chunks[i].buf);
+		doc->chunks[i].buf = NULL;
+		if (ass_render_chunk(doc, i, NULL) < 0)
+			return 0;
+		total += doc->chunks[i].len;
+	}
+	return total;
+}
+
+static void report(const char *name, double elapsed, size_t bytes)
+{
+	printf("  %-26s %10.1f ns/event %8.2f GB/s\n", name,
+	       elapsed * 1e9 / ((double)CUES * ROUNDS),
+	       (double)bytes * ROUNDS / elapsed / 1e9);
+}
+
+int main(void)
+{
+	struct font_config *cfg = get_default_config();
+	char dir[] = "/tmp/ass_bench.XXXXXX";
+	char out[JPSUB_MAX_PATH];
+	struct subtitle *subs;
+	struct ass_doc doc;
+	char *buf = NULL;
+	size_t len = 0, total = 0;
+	double start;
+	FILE *f;
+	int i;
+
+	subs = make_cues(CUES);
+	if (!subs)
+		return 1;
+
+	printf("ASS writer, %d events:\n", CUES);
+
+	start = monotonic_seconds();
+	for (i = 0; i < ROUNDS; i++) {
+		free(buf);
+		buf = NULL;
+		f = open_memstream(&buf, &len);
+		if (!f)
+			return 1;
+		render_stdio(f, subs, CUES, cfg);
+		fclose(f);
+	}
+	report("stdio", monotonic_seconds() - start, len);
+
+	if (ass_doc_init(&doc, subs, CUES, cfg) < 0)
+		return 1;
+
+	start = monotonic_seconds();
+	for (i = 0; i < ROUNDS; i++)
+		total = render_outbuf(&doc);
+	report("output buffer", monotonic_seconds() - start, total);
+
+	if (total != len) {
+		fprintf(stderr, "Renderings differ: %zu and %zu bytes\n",
+			total, len);
+		return 1;
+	}
+	for (i = 0, total = 0; i < doc.nchunks; i++) {
+		if (memcmp(buf + total, doc.chunks[i].buf,
+			   doc.chunks[i].len) != 0) {
+			fprintf(stderr, "Renderings differ in chunk %d\n", i);
+			return 1;
+		}
+		total += doc.chunks[i].len;
+	}
+
+	if (!mkdtemp(dir))
+		return 1;
+	snprintf(out, sizeof(out), "%s/bench.ass", dir);
+
+	start = monotonic_seconds();
+	for (i = 0; i < ROUNDS; i++) {
+		if (ass_doc_write(&doc, out, 0) < 0) {
+			perror(out);
+			return 1;
+		}
+	}
+	report("file write", monotonic_seconds() - start, total);
+
+	unlink(out);
+	rmdir(dir);
+	ass_doc_free(&doc);
+	free(buf);
+	free(subs);
+	return 0;
+}
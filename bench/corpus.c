@@ -0,0 +1,223 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - corpus.c
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ *
+ * Deterministic generator of Japanese SRT files for the benchmarks.
+ * Lines are made of words drawn from small vocabularies of kanji and
+ * kana words. Some lines are taken again from a pool, like opening
+ * lyrics and catchphrases. Some cues share the timing of the previous
+ * one, so they are stacked above it. One cue in five has two lines.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "corpus.h"
+
+#define POOL_LINES	64
+#define LINE_MAX_WORDS	8
+#define LINE_BYTES	256
+
+/*
+ * Every word is an entry of bench/dict/corpus.csv, the test dictionary
+ * of perftest, and no line can be split into them two ways.
+ */
+static const char *const kanji_words[] = {
+	"日本", "学校", "先生", "時間", "電車", "映画", "天気", "会社",
+	"友達", "今日", "明日", "世界", "仕事", "料理", "言葉", "気持ち",
+	"大丈夫", "約束", "本当", "名前", "勉強", "部屋", "自分", "一緒",
+	"危険", "魔法", "戦争", "未来", "記憶", "心配", "必要", "問題"
+};
+
+static const char *const kana_words[] = {
+	"です", "ね", "よ", "そう", "ちょっと", "ありがとう", "は", "が",
+	"を", "に", "の", "だ", "じゃない", "かな", "もう", "まだ",
+	"えっ", "ほら", "すごい", "ごめん", "、", "！", "？", "…"
+};
+
+#define NR_KANJI_WORDS	(sizeof(kanji_words) / sizeof(kanji_words[0]))
+#define NR_KANA_WORDS	(sizeof(kana_words) / sizeof(kana_words[0]))
+
+/* xorshift64*, so the corpus does not depend on the C library */
+static unsigned long long next_random(unsigned long long *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static double uniform(unsigned long long *state)
+{
+	return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static long below(unsigned long long *state, long n)
+{
+	return (long)(next_random(state) % (unsigned long long)n);
+}
+
+static void make_line(char *buf, double kanji, unsigned long long *state)
+{
+	int words = 3 + below(state, LINE_MAX_WORDS - 2);
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < words; i++) {
+		const char *w = uniform(state) < kanji ?
+				kanji_words[below(state, NR_KANJI_WORDS)] :
+				kana_words[below(state, NR_KANA_WORDS)];
+
+		memcpy(buf + len, w, strlen(w));
+		len += strlen(w);
+	}
+	buf[len] = '\0';
+}
+
+void corpus_default_opts(struct corpus_opts *o)
+{
+	o->cues = 20000;
+	o->bytes = 0;
+	o->kanji = 0.4;
+	o->repeat = 0.1;
+	o->simultaneous = 0.05;
+	o->seed = 1;
+}
+
+static int parse_share(const char *arg, double *out)
+{
+	char *end;
+	double v;
+
+	if (!arg)
+		return -1;
+	v = strtod(arg, &end);
+	if (*arg == '\0' || *end != '\0' || v < 0 || v > 1)
+		return -1;
+	*out = v;
+	return 0;
+}
+
+static int parse_long(const char *arg, long *out)
+{
+	char *end;
+	long v;
+
+	if (!arg)
+		return -1;
+	v = strtol(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || v < 0)
+		return -1;
+	*out = v;
+	return 0;
+}
+
+/*
+ * Parse the corpus option at argv[*i], and its value. Returns 1 if it
+ * was one, 0 if not and -1 if its value is invalid.
+ */
+int corpus_parse_arg(struct corpus_opts *o, int argc, char **argv, int *i)
+{
+	const char *opt = argv[*i];
+	const char *val = *i + 1 < argc ? argv[*i + 1] : NULL;
+	long seed;
+	int ret;
+
+	if (strcmp(opt, "--cues") == 0)
+		ret = parse_long(val, &o->cues);
+	else if (strcmp(opt, "--bytes") == 0)
+		ret = parse_long(val, &o->bytes);
+	else if (strcmp(opt, "--kanji") == 0)
+		ret = parse_share(val, &o->kanji);
+	else if (strcmp(opt, "--repeat") == 0)
+		ret = parse_share(val, &o->repeat);
+	else if (strcmp(opt, "--simultaneous") == 0)
+		ret = parse_share(val, &o->simultaneous);
+	else if (strcmp(opt, "--seed") == 0) {
+		ret = parse_long(val, &seed);
+		if (ret == 0)
+			o->seed = seed;
+	} else
+		return 0;
+
+	if (ret < 0) {
+		fprintf(stderr, "Invalid value for %s\n", opt);
+		return -1;
+	}
+	(*i)++;
+	return 1;
+}
+
+void corpus_usage(FILE *f)
+{
+	fprintf(f,
+		"  --cues N          cues to write (default: 20000)\n"
+		"  --bytes N         write cues until the file is N bytes\n"
+		"  --kanji F         share of words in kanji (default: 0.4)\n"
+		"  --repeat F        share of repeated lines (default: 0.1)\n"
+		"  --simultaneous F  share of cues sharing the previous "
+		"timing (default: 0.05)\n"
+		"  --seed N          random seed (default: 1)\n");
+}
+
+static void format_time(char *buf, long ms)
+{
+	sprintf(buf, "%02ld:%02ld:%02ld,%03ld", ms / 3600000,
+		ms / 60000 % 60, ms / 1000 % 60, ms % 1000);
+}
+
+/*
+ * Write the corpus described by @o to @f. Returns -1 on a write error.
+ */
+int corpus_write(FILE *f, const struct corpus_opts *o)
+{
+	static char pool[POOL_LINES][LINE_BYTES];
+	unsigned long long state = o->seed * 0x9E3779B97F4A7C15ULL + 1;
+	char start[32], end[32], line[LINE_BYTES];
+	long written = 0, idx, t = 1000, dur = 0;
+	int i;
+
+	for (i = 0; i < POOL_LINES; i++)
+		make_line(pool[i], o->kanji, &state);
+
+	for (idx = 1; o->bytes ? written < o->bytes : idx <= o->cues; idx++) {
+		int lines = below(&state, 5) == 0 ? 2 : 1;
+		int n;
+
+		/* Simultaneous cues keep the timing of the previous one */
+		if (idx == 1 || uniform(&state) >= o->simultaneous) {
+			t += dur + 100 + below(&state, 700);
+			dur = 1500 + below(&state, 2000);
+		}
+		format_time(start, t);
+		format_time(end, t + dur);
+
+		n = fprintf(f, "%ld\n%s --> %s\n", idx, start, end);
+		if (n < 0)
+			return -1;
+		written += n;
+
+		for (i = 0; i < lines; i++) {
+			const char *text = line;
+
+			if (uniform(&state) < o->repeat)
+				text = pool[below(&state, POOL_LINES)];
+			else
+				make_line(line, o->kanji, &state);
+
+			n = fprintf(f, "%s\n", text);
+			if (n < 0)
+				return -1;
+			written += n;
+		}
+
+		if (fputc('\n', f) == EOF)
+			return -1;
+		written++;
+	}
+	return ferror(f) ? -1 : 0;
+}
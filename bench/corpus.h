@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - corpus.h
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ */
+
+#ifndef JPSUB_CORPUS_H
+#define JPSUB_CORPUS_H
+
+#include <stdio.h>
+
+/*
+ * Corpus options - shape of a synthetic SRT file. The same options and
+ * seed always give the same file.
+ */
+struct corpus_opts {
+	long cues;		/* cues to write, unless @bytes is set */
+	long bytes;		/* stop once the file is this large */
+	double kanji;		/* share of words written in kanji */
+	double repeat;		/* share of lines repeating an earlier one */
+	double simultaneous;	/* share of cues sharing the previous timing */
+	unsigned long seed;
+};
+
+void corpus_default_opts(struct corpus_opts *o);
+int corpus_parse_arg(struct corpus_opts *o, int argc, char **argv, int *i);
+int corpus_write(FILE *f, const struct corpus_opts *o);
+void corpus_usage(FILE *f);
+
+#endif
@@ -0,0 +1,370 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - furigana_bench.c
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ *
+ * Benchmark of each step of a conversion, on a synthetic corpus: parsing
+ * with srt_open(), MeCab analysis of every line with kanji, placing the
+ * readings with calculate_token_positions(), rendering and writing the
+ * .ass with ass_render_chunk() and ass_doc_write(), which analyzes the
+ * lines again, and a whole file from parse to output. No cache is used, so every line goes through MeCab.
+ * Each step runs several rounds and the fastest is kept. Results are
+ * printed, and written as JSON with --json FILE to compare builds.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "corpus.h"
+#include "srt.h"
+#include "ass.h"
+#include "mecab_helpers.h"
+#include "utf8.h"
+#include "utils.h"
+#include "types.h"
+
+#define ROUNDS		3
+
+enum step {
+	STEP_PARSE,
+	STEP_ANALYZE,
+	STEP_POSITIONS,
+	STEP_WRITE,
+	STEP_END_TO_END,
+	NR_STEPS
+};
+
+static const char *const step_names[NR_STEPS] = {
+	"parse", "analyze", "positions", "write_ass", "end_to_end"
+};
+
+/*
+ * Analyzed line - a line with kanji and its tokens, kept to time the
+ * placement of the readings on its own
+ */
+struct analyzed_line {
+	char *text;
+	struct furigana_token *tokens;
+	int count;
+};
+
+struct bench {
+	char path[JPSUB_MAX_PATH];	/* corpus.srt */
+	char out[JPSUB_MAX_PATH];	/* corpus.ass */
+	size_t bytes;
+	struct srt_file srt;
+	struct analyzer an;
+	struct font_config *cfg;
+	struct analyzed_line *lines;
+	int nlines;
+	long tokens;
+	double best[NR_STEPS];
+};
+
+/* Call @fn on every non-empty line of every cue */
+static int for_each_line(struct bench *b,
+			 int (*fn)(struct bench *b, const char *text,
+				   size_t len))
+{
+	int i;
+
+	for (i = 0; i < b->srt.count; i++) {
+		const char *p = b->srt.subs[i].text;
+		const char *end = p + b->srt.subs[i].len;
+
+		while (p < end) {
+			const char *nl = memchr(p, '\n', end - p);
+			size_t len = (nl ? nl : end) - p;
+
+			if (len && fn(b, p, len) < 0)
+				return -1;
+			p += len + 1;
+		}
+	}
+	return 0;
+}
+
+static int analyze_one(struct bench *b, const char *text, size_t len)
+{
+	char *line;
+	int count = 0;
+
+	if (!utf8_has_kanji(text, len))
+		return 0;
+
+	arena_reset(&b->an.arena);
+	line = arena_strndup(&b->an.arena, text, len);
+	if (!line || !analyze_text_with_mecab(&b->an, line, &count))
+		return -1;
+	b->tokens += count;
+	return 0;
+}
+
+static int keep_one(struct bench *b, const char *text, size_t len)
+{
+	struct analyzed_line *l;
+	struct furigana_token *tokens;
+	char *line;
+	int count = 0;
+
+	if (!utf8_has_kanji(text, len))
+		return 0;
+
+	arena_reset(&b->an.arena);
+	line = arena_strndup(&b->an.arena, text, len);
+	tokens = line ? analyze_text_with_mecab(&b->an, line, &count) : NULL;
+	if (!tokens)
+		return -1;
+
+	l = &b->lines[b->nlines++];
+	l->text = strndup(text, len);
+	l->tokens = malloc((count ? count : 1) * sizeof(*tokens));
+	if (!l->text || !l->tokens)
+		return -1;
+	memcpy(l->tokens, tokens, count * sizeof(*tokens));
+	l->count = count;
+
+	/* The readings are in the arena, and placing does not need them */
+	while (count--)
+		l->tokens[count].reading = NULL;
+	return 0;
+}
+
+static int count_one(struct bench *b, const char *text, size_t len)
+{
+	(void)text;
+	(void)len;
+	b->nlines++;
+	return 0;
+}
+
+/* Render and write the .ass of the corpus, as the batch writer does */
+static int write_ass(struct bench *b)
+{
+	struct ass_doc doc;
+	int i, ret = -1;
+
+	if (ass_doc_init(&doc, b->srt.subs, b->srt.count, b->cfg) < 0)
+		return -1;
+	for (i = 0; i < doc.nchunks; i++) {
+		if (ass_render_chunk(&doc, i, &b->an) < 0)
+			goto out;
+	}
+	if (ass_doc_write(&doc, b->out, 0) == 0)
+		ret = 0;
+out:
+	ass_doc_free(&doc);
+	return ret;
+}
+
+static int run_step(struct bench *b, enum step s)
+{
+	int i;
+
+	switch (s) {
+	case STEP_PARSE:
+		srt_close(&b->srt);
+		return srt_open(&b->srt, b->path);
+
+	case STEP_ANALYZE:
+		b->tokens = 0;
+		return for_each_line(b, analyze_one);
+
+	case STEP_POSITIONS:
+		for (i = 0; i < b->nlines; i++)
+			calculate_token_positions(b->lines[i].text,
+						  b->lines[i].tokens,
+						  b->lines[i].count, b->cfg);
+		return 0;
+
+	case STEP_WRITE:
+		return write_ass(b);
+
+	case STEP_END_TO_END:
+		srt_close(&b->srt);
+		if (srt_open(&b->srt, b->path) < 0)
+			return -1;
+		return write_ass(b);
+
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Lines with kanji are analyzed once and kept, with their tokens, for
+ * the placement step.
+ */
+static int prepare_positions(struct bench *b)
+{
+	b->nlines = 0;
+	if (for_each_line(b, count_one) < 0)
+		return -1;
+
+	b->lines = calloc(b->nlines ? b->nlines : 1, sizeof(*b->lines));
+	if (!b->lines)
+		return -1;
+	b->nlines = 0;
+	return for_each_line(b, keep_one);
+}
+
+static double mb_per_sec(const struct bench *b, double seconds)
+{
+	return seconds > 0 ? b->bytes / seconds / 1e6 : 0;
+}
+
+static double cues_per_sec(const struct bench *b, double seconds)
+{
+	return seconds > 0 ? b->srt.count / seconds : 0;
+}
+
+static int write_json(const struct bench *b, const struct corpus_opts *o,
+		      const char *path, int rounds)
+{
+	FILE *f = fopen(path, "w");
+	int s;
+
+	if (!f)
+		return -1;
+
+	fprintf(f, "{\n  \"version\": \"%s\",\n", JPSUB_VERSION);
+	fprintf(f, "  \"corpus\": {\"cues\": %d, \"bytes\": %zu, "
+		"\"kanji\": %.3f, \"repeat\": %.3f, \"simultaneous\": %.3f, "
+		"\"seed\": %lu},\n", b->srt.count, b->bytes, o->kanji,
+		o->repeat, o->simultaneous, o->seed);
+	fprintf(f, "  \"rounds\": %d,\n  \"tokens\": %ld,\n", rounds,
+		b->tokens);
+	fprintf(f, "  \"results\": [\n");
+	for (s = 0; s < NR_STEPS; s++) {
+		fprintf(f, "    {\"step\": \"%s\", \"seconds\": %.6f, "
+			"\"cues_per_sec\": %.1f, \"mb_per_sec\": %.3f}%s\n",
+			step_names[s], b->best[s],
+			cues_per_sec(b, b->best[s]),
+			mb_per_sec(b, b->best[s]), s + 1 < NR_STEPS ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+
+	return fclose(f) != 0 ? -1 : 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n\nOptions:\n", prog);
+	corpus_usage(stderr);
+	fprintf(stderr,
+		"  --rounds N        rounds of each step (default: %d)\n"
+		"  --json FILE       write the results to FILE\n", ROUNDS);
+}
+
+int main(int argc, char **argv)
+{
+	char dir[] = "/tmp/furigana_bench.XXXXXX";
+	struct corpus_opts o;
+	struct bench b;
+	mecab_model_t *model;
+	const char *json = NULL;
+	int rounds = ROUNDS;
+	int ret = 1;
+	int i, s;
+	FILE *f;
+	struct stat st;
+
+	memset(&b, 0, sizeof(b));
+	corpus_default_opts(&o);
+
+	for (i = 1; i < argc; i++) {
+		int r = corpus_parse_arg(&o, argc, argv, &i);
+
+		if (r > 0)
+			continue;
+		if (r == 0 && i + 1 < argc && strcmp(argv[i], "--json") == 0) {
+			json = argv[++i];
+			continue;
+		}
+		if (r == 0 && i + 1 < argc &&
+		    strcmp(argv[i], "--rounds") == 0) {
+			rounds = atoi(argv[++i]);
+			if (rounds > 0)
+				continue;
+		}
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (!mkdtemp(dir)) {
+		perror(dir);
+		return 1;
+	}
+	snprintf(b.path, sizeof(b.path), "%s/corpus.srt", dir);
+	snprintf(b.out, sizeof(b.out), "%s/corpus.ass", dir);
+
+	f = fopen(b.path, "w");
+	if (!f || corpus_write(f, &o) < 0 || fclose(f) != 0 ||
+	    stat(b.path, &st) < 0) {
+		perror(b.path);
+		goto out_dir;
+	}
+	b.bytes = st.st_size;
+
+	model = load_mecab_model();
+	if (!model)
+		goto out_dir;
+	if (analyzer_init(&b.an, model, MECAB_READING_FIELD) < 0) {
+		fprintf(stderr, "MeCab initialization failed\n");
+		goto out_model;
+	}
+	b.cfg = get_default_config();
+
+	if (srt_open(&b.srt, b.path) < 0 || prepare_positions(&b) < 0) {
+		perror(b.path);
+		goto out_analyzer;
+	}
+
+	printf("Corpus: %d cues, %.2f MB, %d lines with kanji\n",
+	       b.srt.count, b.bytes / 1e6, b.nlines);
+
+	for (s = 0; s < NR_STEPS; s++) {
+		for (i = 0; i < rounds; i++) {
+			double start = monotonic_seconds(), elapsed;
+
+			if (run_step(&b, s) < 0) {
+				perror(step_names[s]);
+				goto out_lines;
+			}
+			elapsed = monotonic_seconds() - start;
+			if (i == 0 || elapsed < b.best[s])
+				b.best[s] = elapsed;
+		}
+		printf("  %-14s %9.3f s %12.0f cues/s %9.2f MB/s\n",
+		       step_names[s], b.best[s], cues_per_sec(&b, b.best[s]),
+		       mb_per_sec(&b, b.best[s]));
+	}
+
+	if (json && write_json(&b, &o, json, rounds) < 0) {
+		perror(json);
+		goto out_lines;
+	}
+	ret = 0;
+
+out_lines:
+	for (i = 0; i < b.nlines; i++) {
+		free(b.lines[i].text);
+		free(b.lines[i].tokens);
+	}
+	free(b.lines);
+out_analyzer:
+	srt_close(&b.srt);
+	analyzer_destroy(&b.an);
+out_model:
+	mecab_model_destroy(model);
+out_dir:
+	unlink(b.out);
+	unlink(b.path);
+	rmdir(dir);
+	return ret;
+}
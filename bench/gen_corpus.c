@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - gen_corpus.c
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ *
+ * Write a synthetic Japanese SRT file, to standard output or -o FILE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+
+#include "corpus.h"
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] [-o FILE]\n\nOptions:\n", prog);
+	corpus_usage(stderr);
+}
+
+int main(int argc, char **argv)
+{
+	struct corpus_opts o;
+	const char *out = NULL;
+	FILE *f = stdout;
+	int i;
+
+	corpus_default_opts(&o);
+
+	for (i = 1; i < argc; i++) {
+		int ret = corpus_parse_arg(&o, argc, argv, &i);
+
+		if (ret > 0)
+			continue;
+		if (ret == 0 && strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			out = argv[++i];
+			continue;
+		}
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (out) {
+		f = fopen(out, "w");
+		if (!f) {
+			perror(out);
+			return 1;
+		}
+	}
+
+	if (corpus_write(f, &o) < 0 || (out && fclose(f) != 0)) {
+		perror(out ? out : "stdout");
+		return 1;
+	}
+	return 0;
+}
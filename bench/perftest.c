@@ -0,0 +1,566 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - perftest.c
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ *
+ * Performance regression test. A fixed corpus of generated SRT files is
+ * converted by the converter given on the command line, once per output
+ * mode, for several rounds. Every output is compared with its golden
+ * copy, gzipped under the golden folder, and the throughput of the
+ * fastest round, in cues/s of pipeline wall time as --stats-json reports
+ * it, is compared with the baseline recorded for the machine. The test
+ * fails on any difference, or if the throughput falls more than the
+ * tolerance below the baseline.
+ *
+ * Readings, and so where furigana go, depend on the MeCab dictionary, so
+ * there is a set of golden outputs per dictionary, named after what
+ * MeCab reports of it rather than where it is installed. make perftest
+ * runs on the test dictionary of bench/dict, which has a set. Without
+ * a set the test fails: sets are only written by --update-golden.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <zlib.h>
+#include <mecab.h>
+
+#include "corpus.h"
+
+#define ROUNDS		5
+#define TOLERANCE	10.0
+#define PATH_BYTES	4096
+#define MAX_ARGS	64
+
+/*
+ * The corpus. Changing it, or the output of the converter, means
+ * regenerating the golden files.
+ */
+static const struct {
+	const char *name;
+	struct corpus_opts opts;
+} files[] = {
+	{ "dense",	{ 3000, 0, 0.6, 0.1, 0.05, 101 } },
+	{ "sparse",	{ 3000, 0, 0.15, 0.3, 0.2, 102 } },
+	{ "kana",	{ 1000, 0, 0.0, 0.1, 0.05, 103 } },
+};
+
+static const struct {
+	const char *name;
+	const char *arg;	/* converter option of the mode, if any */
+} modes[] = {
+	{ "default",	NULL },
+	{ "packed",	"--pack-furigana" },
+};
+
+#define NR_FILES	(sizeof(files) / sizeof(files[0]))
+#define NR_MODES	(sizeof(modes) / sizeof(modes[0]))
+
+struct perftest {
+	char dir[64];		/* mkdtemp() template */
+	const char *golden;
+	char golden_dir[PATH_BYTES / 2];	/* set of the dictionary */
+	const char *baseline;
+	double tolerance;
+	int rounds;
+	int update_golden;
+	int update_baseline;
+	char **conv;		/* converter and its options */
+	int nconv;
+};
+
+/*
+ * Run the converter on the folder of @mode, and take the wall time and
+ * cue count of the run from the total line of its stats.
+ */
+static int run_mode(const struct perftest *t, size_t mode, double *wall,
+		    long *cues)
+{
+	char path[PATH_BYTES], json[PATH_BYTES], line[1024];
+	const char *argv[MAX_ARGS];
+	const char *p;
+	int argc = 0, status, fd, i, found = 0;
+	pid_t pid;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", t->dir, modes[mode].name);
+	snprintf(json, sizeof(json), "%s/%s.json", t->dir, modes[mode].name);
+
+	for (i = 0; i < t->nconv; i++)
+		argv[argc++] = t->conv[i];
+	if (modes[mode].arg)
+		argv[argc++] = modes[mode].arg;
+	argv[argc++] = "--stats-json";
+	argv[argc++] = json;
+	argv[argc++] = path;
+	argv[argc] = NULL;
+
+	pid = fork();
+	if (pid < 0)
+		return -1;
+	if (pid == 0) {
+		fd = open("/dev/null", O_WRONLY);
+		if (fd >= 0)
+			dup2(fd, STDOUT_FILENO);
+		execvp(argv[0], (char *const *)argv);
+		perror(argv[0]);
+		_exit(127);
+	}
+	if (waitpid(pid, &status, 0) < 0)
+		return -1;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "%s: conversion of %s failed\n", argv[0],
+			path);
+		return -1;
+	}
+
+	f = fopen(json, "r");
+	if (!f) {
+		perror(json);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (strncmp(line, "{\"total\":true", 13) != 0)
+			continue;
+		p = strstr(line, "\"wall_s\":");
+		if (p)
+			*wall = strtod(p + 9, NULL);
+		p = strstr(line, "\"cues\":");
+		if (p)
+			*cues = strtol(p + 7, NULL, 10);
+		found = 1;
+	}
+	fclose(f);
+
+	if (!found) {
+		fprintf(stderr, "%s: no total line\n", json);
+		return -1;
+	}
+	return 0;
+}
+
+static char *read_all(const char *path, size_t *len)
+{
+	char *buf = NULL, *tmp;
+	size_t cap = 0;
+	int n;
+	gzFile gz = gzopen(path, "rb");
+
+	/* gzread() passes files that are not gzipped through */
+	if (!gz)
+		return NULL;
+
+	*len = 0;
+	do {
+		if (cap - *len < 65536) {
+			cap = cap ? cap * 2 : 1 << 20;
+			tmp = realloc(buf, cap);
+			if (!tmp) {
+				free(buf);
+				gzclose(gz);
+				return NULL;
+			}
+			buf = tmp;
+		}
+		n = gzread(gz, buf + *len, 65536);
+		if (n > 0)
+			*len += n;
+	} while (n > 0);
+
+	if (gzclose(gz) != Z_OK || n < 0) {
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+static int write_golden(const char *path, const char *data, size_t len)
+{
+	gzFile gz;
+	int ret = 0;
+
+	gz = gzopen(path, "wb9");
+	if (!gz)
+		return -1;
+	if (len && gzwrite(gz, data, len) != (int)len)
+		ret = -1;
+	if (gzclose(gz) != Z_OK)
+		ret = -1;
+	return ret;
+}
+
+/* Line number of the first difference between @a and @b */
+static long first_difference(const char *a, size_t alen, const char *b,
+			     size_t blen)
+{
+	long line = 1;
+	size_t i;
+
+	for (i = 0; i < alen && i < blen && a[i] == b[i]; i++) {
+		if (a[i] == '\n')
+			line++;
+	}
+	return line;
+}
+
+/*
+ * Compare the output of @file in @mode with its golden copy, or make it
+ * the golden copy when updating.
+ */
+static int check_output(const struct perftest *t, size_t mode, size_t file)
+{
+	char out[PATH_BYTES], gold[PATH_BYTES];
+	char *o, *g;
+	size_t olen, glen;
+	int ret = -1;
+
+	snprintf(out, sizeof(out), "%s/%s/%s.ass", t->dir, modes[mode].name,
+		 files[file].name);
+	snprintf(gold, sizeof(gold), "%s/%s/%s.ass.gz", t->golden_dir,
+		 modes[mode].name, files[file].name);
+
+	o = read_all(out, &olen);
+	if (!o) {
+		perror(out);
+		return -1;
+	}
+
+	if (t->update_golden) {
+		snprintf(gold, sizeof(gold), "%s/%s", t->golden_dir,
+			 modes[mode].name);
+		mkdir(t->golden, 0755);
+		mkdir(t->golden_dir, 0755);
+		mkdir(gold, 0755);
+		snprintf(gold, sizeof(gold), "%s/%s/%s.ass.gz", t->golden_dir,
+			 modes[mode].name, files[file].name);
+		if (write_golden(gold, o, olen) < 0)
+			perror(gold);
+		else
+			ret = 0;
+		free(o);
+		return ret;
+	}
+
+	g = read_all(gold, &glen);
+	if (!g) {
+		fprintf(stderr, "%s: %s, run make perftest-golden\n", gold,
+			errno == ENOENT ? "no golden output" :
+					  "cannot read golden output");
+		free(o);
+		return -1;
+	}
+
+	if (olen != glen || memcmp(o, g, olen) != 0)
+		fprintf(stderr, "%s/%s.ass differs from the golden output "
+			"at line %ld\n", modes[mode].name, files[file].name,
+			first_difference(o, olen, g, glen));
+	else
+		ret = 0;
+
+	free(g);
+	free(o);
+	return ret;
+}
+
+/*
+ * Name the dictionaries MeCab loads by default, the ones the converter
+ * uses, after their charset, entry count and version, e.g.
+ * utf8-392126-v102 for IPAdic.
+ */
+static int dictionary_name(char *buf, size_t size)
+{
+	const mecab_dictionary_info_t *d;
+	mecab_model_t *model = mecab_model_new2("");
+	size_t len = 0;
+	const char *c;
+
+	if (!model) {
+		fprintf(stderr, "MeCab initialization failed\n");
+		return -1;
+	}
+
+	buf[0] = '\0';
+	for (d = mecab_model_dictionary_info(model); d; d = d->next) {
+		if (len && len + 1 < size)
+			buf[len++] = '+';
+		for (c = d->charset; *c && len + 1 < size; c++) {
+			if (isalnum((unsigned char)*c))
+				buf[len++] = tolower((unsigned char)*c);
+		}
+		len += snprintf(buf + len, size - len, "-%u-v%u", d->size,
+				d->version);
+		if (len >= size) {
+			mecab_model_destroy(model);
+			return -1;
+		}
+	}
+	mecab_model_destroy(model);
+	return 0;
+}
+
+static int read_baseline(const char *path, double *cps)
+{
+	char line[256];
+	FILE *f = fopen(path, "r");
+	int found = 0;
+
+	if (!f)
+		return -1;
+	while (!found && fgets(line, sizeof(line), f))
+		found = sscanf(line, "cues_per_sec %lf", cps) == 1;
+	fclose(f);
+	return found ? 0 : -1;
+}
+
+static int write_baseline(const char *path, double cps)
+{
+	char host[256];
+	FILE *f = fopen(path, "w");
+
+	if (!f)
+		return -1;
+	if (gethostname(host, sizeof(host)) < 0)
+		strcpy(host, "unknown");
+	host[sizeof(host) - 1] = '\0';
+	fprintf(f, "# perftest baseline of %s\ncues_per_sec %.1f\n", host, cps);
+	return fclose(f) != 0 ? -1 : 0;
+}
+
+/* Write the corpus into a folder per mode */
+static int write_corpus(const struct perftest *t)
+{
+	char path[PATH_BYTES];
+	size_t m, i;
+	FILE *f;
+
+	for (m = 0; m < NR_MODES; m++) {
+		snprintf(path, sizeof(path), "%s/%s", t->dir, modes[m].name);
+		if (mkdir(path, 0755) < 0) {
+			perror(path);
+			return -1;
+		}
+		for (i = 0; i < NR_FILES; i++) {
+			snprintf(path, sizeof(path), "%s/%s/%s.srt", t->dir,
+				 modes[m].name, files[i].name);
+			f = fopen(path, "w");
+			if (!f || corpus_write(f, &files[i].opts) < 0 ||
+			    fclose(f) != 0) {
+				perror(path);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static void remove_corpus(const struct perftest *t)
+{
+	char path[PATH_BYTES];
+	size_t m, i;
+
+	for (m = 0; m < NR_MODES; m++) {
+		for (i = 0; i < NR_FILES; i++) {
+			snprintf(path, sizeof(path), "%s/%s/%s.srt", t->dir,
+				 modes[m].name, files[i].name);
+			unlink(path);
+			snprintf(path, sizeof(path), "%s/%s/%s.ass", t->dir,
+				 modes[m].name, files[i].name);
+			unlink(path);
+		}
+		snprintf(path, sizeof(path), "%s/%s.json", t->dir,
+			 modes[m].name);
+		unlink(path);
+		snprintf(path, sizeof(path), "%s/%s", t->dir, modes[m].name);
+		rmdir(path);
+	}
+	rmdir(t->dir);
+}
+
+/*
+ * Check the throughput of the fastest round against the baseline, or
+ * record it if there is none yet or when updating.
+ */
+static int check_throughput(const struct perftest *t, double cps)
+{
+	double base, floor;
+
+	if (t->update_baseline || read_baseline(t->baseline, &base) < 0) {
+		if (write_baseline(t->baseline, cps) < 0) {
+			perror(t->baseline);
+			return -1;
+		}
+		printf("Throughput: %.1f cues/s, recorded as the baseline "
+		       "in %s\n", cps, t->baseline);
+		return 0;
+	}
+
+	floor = base * (1.0 - t->tolerance / 100.0);
+	printf("Throughput: %.1f cues/s, baseline %.1f cues/s (%+.1f%%)\n",
+	       cps, base, (cps / base - 1.0) * 100.0);
+	if (cps < floor) {
+		fflush(stdout);
+		fprintf(stderr, "Throughput is more than %.1f%% below the "
+			"baseline\n", t->tolerance);
+		return -1;
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] CONVERTER [converter options]\n\n"
+		"Options:\n"
+		"  --golden DIR      golden outputs, a folder per dictionary "
+		"(required)\n"
+		"  --baseline FILE   throughput baseline of this machine "
+		"(required)\n"
+		"  --tolerance PCT   allowed drop below the baseline "
+		"(default: %.0f)\n"
+		"  --rounds N        runs of the corpus, the fastest is kept "
+		"(default: %d)\n"
+		"  --update-golden   replace the golden outputs of the "
+		"dictionary\n"
+		"  --update-baseline record the throughput as the baseline\n",
+		prog, TOLERANCE, ROUNDS);
+}
+
+static int parse_options(struct perftest *t, int argc, char **argv)
+{
+	char *end;
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		const char *opt = argv[i];
+		const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (strcmp(opt, "--update-golden") == 0) {
+			t->update_golden = 1;
+			continue;
+		}
+		if (strcmp(opt, "--update-baseline") == 0) {
+			t->update_baseline = 1;
+			continue;
+		}
+		if (!val)
+			return -1;
+		i++;
+
+		if (strcmp(opt, "--golden") == 0) {
+			t->golden = val;
+		} else if (strcmp(opt, "--baseline") == 0) {
+			t->baseline = val;
+		} else if (strcmp(opt, "--tolerance") == 0) {
+			t->tolerance = strtod(val, &end);
+			if (*end || t->tolerance < 0 || t->tolerance >= 100)
+				return -1;
+		} else if (strcmp(opt, "--rounds") == 0) {
+			t->rounds = atoi(val);
+			if (t->rounds <= 0)
+				return -1;
+		} else {
+			return -1;
+		}
+	}
+
+	/* Room for the mode option, --stats-json FILE and the folder */
+	if (i >= argc || argc - i > MAX_ARGS - 5 || !t->golden ||
+	    !t->baseline)
+		return -1;
+	t->conv = argv + i;
+	t->nconv = argc - i;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct perftest t;
+	char dict[256];
+	struct stat st;
+	double best = 0;
+	long cues = 0;
+	int failed = 0;
+	int r;
+	size_t m, i;
+
+	memset(&t, 0, sizeof(t));
+	t.tolerance = TOLERANCE;
+	t.rounds = ROUNDS;
+	if (parse_options(&t, argc, argv) < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (dictionary_name(dict, sizeof(dict)) < 0)
+		return 1;
+	snprintf(t.golden_dir, sizeof(t.golden_dir), "%s/%s", t.golden, dict);
+	if (!t.update_golden && stat(t.golden_dir, &st) < 0) {
+		fprintf(stderr, "%s: no golden outputs for dictionary %s, "
+			"run make perftest-golden\n", t.golden_dir, dict);
+		return 1;
+	}
+
+	strcpy(t.dir, "/tmp/furigana_perftest.XXXXXX");
+	if (!mkdtemp(t.dir)) {
+		perror(t.dir);
+		return 1;
+	}
+	if (write_corpus(&t) < 0) {
+		remove_corpus(&t);
+		return 1;
+	}
+
+	for (r = 0; r < t.rounds; r++) {
+		double wall = 0;
+
+		cues = 0;
+		for (m = 0; m < NR_MODES; m++) {
+			double w = 0;
+			long c = 0;
+
+			if (run_mode(&t, m, &w, &c) < 0) {
+				remove_corpus(&t);
+				return 1;
+			}
+			wall += w;
+			cues += c;
+		}
+		if (r == 0 || wall < best)
+			best = wall;
+	}
+
+	/* The outputs of the last round, every round writes the same */
+	for (m = 0; m < NR_MODES; m++) {
+		for (i = 0; i < NR_FILES; i++) {
+			if (check_output(&t, m, i) < 0)
+				failed = 1;
+		}
+	}
+	remove_corpus(&t);
+
+	if (t.update_golden && !failed)
+		printf("Golden outputs written to %s\n", t.golden_dir);
+	else if (!failed)
+		printf("Outputs: %zu files match the golden outputs of %s\n",
+		       NR_MODES * NR_FILES, dict);
+
+	if (best <= 0) {
+		fprintf(stderr, "No time measured\n");
+		return 1;
+	}
+	printf("Corpus: %ld cues, fastest of %d rounds %.3f s\n", cues,
+	       t.rounds, best);
+
+	/* The speed of wrong outputs is no baseline */
+	if (failed)
+		return 1;
+	return check_throughput(&t, cues / best) < 0 ? 1 : 0;
+}
@@ -0,0 +1,164 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - utf8_bench.c
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ *
+ * Microbenchmark of UTF-8 character counting: a typical subtitle line
+ * and a pathological 64 KiB line, counted with the scalar loop and with
+ * the dispatched SIMD kernel, node offsets found by rescanning the line
+ * from the start or by counting from the previous node, and the kanji
+ * prefilter on a line without kanji, which it has to scan completely.
+ * The dispatched count is first checked against the scalar loop.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utf8.h"
+#include "utils.h"
+
+#define NODE_BYTES	6	/* two kanji or kana per node */
+#define CHECK_BYTES	96	/* three times the widest kernel */
+
+typedef size_t (*count_fn)(const char *s, size_t len);
+
+static volatile size_t sink;
+
+static const char *const mixed[] = {
+	"日本", "語の", "字幕", "です", "、", "ね", "！", "ab"
+};
+
+static const char *const kana[] = {
+	"うん", "えっ", "そう", "です", "、", "ね", "！", "ab"
+};
+
+/*
+ * Compare the dispatched count with the scalar loop on every byte value,
+ * repeated and mixed with the others, for every length up to
+ * CHECK_BYTES, so both kernels and their scalar tails are covered.
+ */
+static int check_count(void)
+{
+	char buf[CHECK_BYTES];
+	size_t len, i;
+	int b, mix;
+
+	for (b = 0; b < 256; b++) {
+		for (mix = 0; mix < 2; mix++) {
+			for (i = 0; i < sizeof(buf); i++)
+				buf[i] = (char)(mix ? b + (int)i * 37 : b);
+
+			for (len = 0; len <= sizeof(buf); len++) {
+				size_t want = utf8_count_scalar(buf, len);
+				size_t got = utf8_count(buf, len);
+
+				if (got == want)
+					continue;
+				fprintf(stderr, "utf8_count: %zu characters "
+					"instead of %zu, byte 0x%02X%s, "
+					"%zu bytes\n", got, want, b,
+					mix ? " mixed" : "", len);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static char *make_line(const char *const *pieces, size_t len)
+{
+	char *line = malloc(len + 8);
+	size_t n = 0;
+	int i = 0;
+
+	if (!line)
+		return NULL;
+
+	while (n < len) {
+		const char *p = pieces[i++ % 8];
+
+		memcpy(line + n, p, strlen(p));
+		n += strlen(p);
+	}
+	line[n] = '\0';
+	return line;
+}
+
+static void bench_count(const char *name, count_fn fn, const char *line,
+			long iters)
+{
+	size_t len = strlen(line);
+	double start, elapsed;
+	long i;
+
+	start = monotonic_seconds();
+	for (i = 0; i < iters; i++)
+		sink += fn(line, len);
+	elapsed = monotonic_seconds() - start;
+
+	printf("  %-26s %10.1f ns/line %8.2f GB/s\n", name,
+	       elapsed * 1e9 / iters, len * (double)iters / elapsed / 1e9);
+}
+
+/* Character offset of every node, recounted from the start of the line */
+static size_t offsets_rescan(const char *line, size_t len)
+{
+	size_t off, total = 0;
+
+	for (off = 0; off < len; off += NODE_BYTES)
+		total += utf8_count(line, off);
+	return total;
+}
+
+/* Character offset of every node, counted on from the previous node */
+static size_t offsets_incremental(const char *line, size_t len)
+{
+	size_t off, prev = 0, pos = 0, total = 0;
+
+	for (off = 0; off < len; off += NODE_BYTES) {
+		pos += utf8_count(line + prev, off - prev);
+		prev = off;
+		total += pos;
+	}
+	return total;
+}
+
+static size_t has_kanji(const char *s, size_t len)
+{
+	return utf8_has_kanji(s, len);
+}
+
+static void run(const char *title, size_t len, long iters)
+{
+	char *line = make_line(mixed, len);
+
+	if (!line)
+		return;
+
+	printf("%s (%zu bytes):\n", title, strlen(line));
+	bench_count("count, scalar", utf8_count_scalar, line, iters);
+	bench_count("count, dispatched", utf8_count, line, iters);
+	bench_count("node offsets, rescan", offsets_rescan, line,
+		    len > 4096 ? iters / 1000 : iters);
+	bench_count("node offsets, running", offsets_incremental, line,
+		    iters);
+	free(line);
+
+	line = make_line(kana, len);
+	if (!line)
+		return;
+	bench_count("kanji prefilter, no kanji", has_kanji, line, iters);
+	free(line);
+}
+
+int main(void)
+{
+	if (check_count() < 0)
+		return 1;
+	run("Short subtitle line", 48, 2000000);
+	run("Long line", 65536, 2000);
+	return 0;
+}
@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - archive.h
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ */
+
+#ifndef JPSUB_ARCHIVE_H
+#define JPSUB_ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+enum member_method {
+	MEMBER_TAR,		/* tar: the data itself at @offset */
+	MEMBER_TAR_GZ,		/* compressed tar: @offset once decompressed */
+	MEMBER_ZIP_STORED,	/* zip: local header at @offset */
+	MEMBER_ZIP_DEFLATED,
+};
+
+/*
+ * Archive member - where an SRT file is in an archive, or its contents
+ * when they were decompressed while the archive was listed
+ */
+struct archive_member {
+	const char *name;	/* path inside the archive */
+	enum member_method method;
+	off_t offset;
+	size_t size;		/* stored size */
+	size_t usize;		/* size once extracted */
+	uint32_t crc;		/* zip only */
+	char *data;		/* usize bytes, or NULL to read at @offset */
+	void *stream;		/* compressed tar, while it is listed */
+};
+
+typedef int (*archive_fn)(struct archive_member *m, void *data);
+
+int archive_list(const char *path, archive_fn fn, void *data);
+int archive_load(struct archive_member *m);
+int archive_read(const char *path, struct archive_member *m, char **buf,
+		 size_t *len);
+
+struct zip_out;
+
+struct zip_out *zip_out_new(const char *path, time_t mtime);
+int zip_out_add(struct zip_out *z, const char *name, const struct iovec *iov,
+		int n);
+int zip_out_write(struct zip_out *z);
+const char *zip_out_path(const struct zip_out *z);
+void zip_out_free(struct zip_out *z);
+
+#endif
@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - arena.h
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ */
+
+#ifndef JPSUB_ARENA_H
+#define JPSUB_ARENA_H
+
+#include <stddef.h>
+
+struct arena_block;
+struct mem_account;
+
+/*
+ * Arena - bump allocator for data that lives as long as one subtitle
+ * line. Resetting keeps the blocks, so once they have grown large
+ * enough, processing a line allocates nothing from the heap.
+ *
+ * The blocks outlive any one line: they are charged to the memory
+ * account current when the arena was set up. The space a line uses is
+ * charged to the account current when it is allocated, until the next
+ * reset.
+ */
+struct arena {
+	struct arena_block *head;
+	struct arena_block *cur;
+	struct mem_account *account;	/* the blocks are charged to */
+	struct mem_account *charged;	/* the space in use is charged to */
+	size_t used;
+};
+
+void arena_init(struct arena *a);
+void *arena_alloc(struct arena *a, size_t size);
+char *arena_strndup(struct arena *a, const char *s, size_t len);
+void arena_reset(struct arena *a);
+void arena_free(struct arena *a);
+
+#endif
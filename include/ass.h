@@ -7,10 +7,47 @@
 #ifndef JPSUB_ASS_H
 #define JPSUB_ASS_H
 
-#include <mecab.h>
+#include <stdio.h>
+#include <stddef.h>
 #include "types.h"
 
-void generate_ass(const char *input, struct subtitle *subs, int count,
-		  struct font_config *cfg, mecab_t *mecab);
+struct analyzer;
+struct srt_stream;
+struct zip_out;
+
+/*
+ * Chunk - a range of cues whose Dialogue events are rendered to memory
+ */
+struct ass_chunk {
+	int first;
+	int last;
+	char *buf;
+	size_t len;
+};
+
+/*
+ * Document - the events of one .ass file, split into chunks that can be
+ * rendered by different threads and written out in order.
+ */
+struct ass_doc {
+	struct subtitle *subs;
+	int count;
+	struct font_config *cfg;
+	struct ass_chunk *chunks;
+	int nchunks;
+	size_t written;		/* bytes of the output, 0 if kept */
+};
+
+int ass_doc_init(struct ass_doc *doc, struct subtitle *subs, int count,
+		 struct font_config *cfg);
+int ass_doc_has_kanji(const struct ass_doc *doc);
+int ass_render_chunk(struct ass_doc *doc, int idx, struct analyzer *an);
+int ass_doc_write(struct ass_doc *doc, const char *out, int keep_identical);
+int ass_doc_write_zip(struct ass_doc *doc, struct zip_out *z,
+		      const char *name);
+void ass_doc_free(struct ass_doc *doc);
+
+int ass_stream(struct srt_stream *in, FILE *out, struct font_config *cfg,
+	       struct analyzer *an);
 
 #endif
@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - batch.h
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ */
+
+#ifndef JPSUB_BATCH_H
+#define JPSUB_BATCH_H
+
+#include <mecab.h>
+#include "types.h"
+
+/*
+ * Batch - files and folders to convert, in command-line order
+ */
+struct batch {
+	char **roots;
+	int count;
+	int capacity;
+};
+
+/*
+ * Batch options - number of threads in each pipeline stage
+ */
+struct batch_opts {
+	int walkers;
+	int parsers;
+	int analyzers;
+	int writers;
+	int cache_lines;	/* line cache entries, 0 to disable */
+	const char *disk_cache;	/* readings cache file, or NULL */
+	const char *manifest;	/* skip unchanged inputs, or NULL */
+	int reading_field;	/* MeCab feature field with the reading */
+	int zip_output;		/* put outputs of archives in a zip */
+	int report;		/* print stage occupancy at the end */
+	int stats;		/* print stage timers and counters */
+	const char *stats_json;	/* also as JSON lines to this file */
+	int mem_stats;		/* print allocations and peaks */
+	long long mem_budget;	/* bytes a file may hold, 0 for no limit */
+};
+
+int batch_add_path(struct batch *b, const char *path);
+void batch_default_opts(struct batch_opts *opts);
+int batch_run(struct batch *b, struct font_config *cfg, mecab_model_t *model,
+	      const struct batch_opts *opts);
+int batch_stream(struct font_config *cfg, mecab_model_t *model,
+		 const struct batch_opts *opts);
+void batch_free(struct batch *b);
+
+#endif
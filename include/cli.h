@@ -11,7 +11,7 @@
 #include "types.h"
 
 struct cli_ctx {
-	mecab_t *mecab;
+	mecab_model_t *model;
 	struct font_config *cfg;
 };
 
@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - disk_cache.h
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ */
+
+#ifndef JPSUB_DISK_CACHE_H
+#define JPSUB_DISK_CACHE_H
+
+#include <stdint.h>
+#include "types.h"
+
+struct disk_cache;
+struct arena;
+
+/*
+ * Disk cache counters
+ */
+struct disk_cache_stats {
+	long loaded;		/* records usable with this dictionary */
+	long hits;
+	long misses;
+	long appended;
+};
+
+struct disk_cache *disk_cache_open(const char *path, uint64_t fingerprint);
+void disk_cache_close(struct disk_cache *dc);
+
+int disk_cache_get(struct disk_cache *dc, const char *line, struct arena *a,
+		   struct furigana_token **tokens, int *token_count);
+void disk_cache_put(struct disk_cache *dc, const char *line, struct arena *a,
+		    const struct furigana_token *tokens, int token_count);
+void disk_cache_get_stats(struct disk_cache *dc, struct disk_cache_stats *st);
+
+int disk_cache_compact(const char *path, uint64_t fingerprint, long *kept,
+		       long *dropped);
+
+#endif
@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - line_cache.h
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ */
+
+#ifndef JPSUB_LINE_CACHE_H
+#define JPSUB_LINE_CACHE_H
+
+#include "types.h"
+
+struct line_cache;
+struct arena;
+
+/*
+ * Line cache counters
+ */
+struct line_cache_stats {
+	long hits;
+	long misses;
+	long evictions;
+	long entries;
+};
+
+struct line_cache *line_cache_new(int max_entries);
+void line_cache_free(struct line_cache *c);
+
+int line_cache_get(struct line_cache *c, const char *line,
+		   const struct font_config *cfg, struct arena *a,
+		   struct furigana_token **tokens, int *token_count);
+void line_cache_put(struct line_cache *c, const char *line,
+		    const struct font_config *cfg,
+		    const struct furigana_token *tokens, int token_count);
+void line_cache_get_stats(struct line_cache *c, struct line_cache_stats *st);
+
+#endif
@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - manifest.h
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ */
+
+#ifndef JPSUB_MANIFEST_H
+#define JPSUB_MANIFEST_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Manifest entry - what an output was generated from
+ */
+struct manifest_entry {
+	char *path;		/* real path of the source */
+	char version[16];	/* tool version */
+	uint64_t cfg_hash;
+	long long size;		/* source size and mtime */
+	struct timespec mtime;
+	uint64_t src_hash;
+	int count;		/* subtitles converted */
+	long long out_size;	/* output size and mtime */
+	struct timespec out_mtime;
+};
+
+/*
+ * Manifest - entries by source path
+ */
+struct manifest {
+	struct manifest_entry *entries;
+	int count;
+	int capacity;
+	int *index;		/* open addressing, -1 for empty slots */
+	int nindex;		/* power of two */
+};
+
+int manifest_load(struct manifest *m, const char *path);
+const struct manifest_entry *manifest_find(const struct manifest *m,
+					   const char *path);
+int manifest_set(struct manifest *m, const struct manifest_entry *e);
+void manifest_remove(struct manifest *m, const char *path);
+int manifest_save(const struct manifest *m, const char *path);
+void manifest_free(struct manifest *m);
+
+#endif
@@ -9,11 +9,44 @@
 
 #include <mecab.h>
 #include "types.h"
+#include "line_cache.h"
+#include "disk_cache.h"
+#include "arena.h"
 
-char *extract_mecab_field(const char *feature, int index);
-char *katakana_to_hiragana(const char *in);
+struct reading_cache;
+struct conv_stats;
 
-struct furigana_token *analyze_text_with_mecab(mecab_t *mecab, const char *line,
+/*
+ * Analyzer - per-thread MeCab state. The tagger and lattice are created
+ * from the shared model and reused for every line, as are the cache of
+ * node readings and the arena the tokens of a line are allocated from.
+ * The line and disk caches, if any, are shared by all analyzers of a
+ * batch. With --stats, the time spent and the nodes seen are added to
+ * @stats, which belongs to the analyzer's thread.
+ */
+struct analyzer {
+	mecab_t *tagger;
+	mecab_lattice_t *lattice;
+	struct reading_cache *readings;
+	struct arena arena;
+	int reading_field;	/* feature field holding the reading */
+	struct line_cache *cache;
+	struct disk_cache *disk;
+	struct conv_stats *stats;	/* NULL unless collecting */
+};
+
+int parse_reading_field(const char *arg);
+const char *mecab_field_span(const char *feature, int index, size_t *len);
+char *katakana_to_hiragana(struct arena *a, const char *in, size_t len);
+
+mecab_model_t *load_mecab_model(void);
+uint64_t dictionary_fingerprint(mecab_model_t *model, int reading_field);
+int analyzer_init(struct analyzer *an, mecab_model_t *model,
+		  int reading_field);
+void analyzer_destroy(struct analyzer *an);
+
+struct furigana_token *analyze_text_with_mecab(struct analyzer *an,
+					       const char *line,
 					       int *token_count);
 void calculate_token_positions(const char *line, struct furigana_token *tokens,
 			       int token_count, struct font_config *cfg);
@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - mem.h
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ */
+
+#ifndef JPSUB_MEM_H
+#define JPSUB_MEM_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+ * Memory account - the heap memory charged to one stage of one file,
+ * to a file or to a whole run. What is charged to an account is also
+ * charged to its parent. A budget caps the bytes an account may hold
+ * at once; allocations that would go over it fail.
+ */
+struct mem_account {
+	struct mem_account *parent;
+	long long budget;	/* 0 for none */
+	long allocs;
+	long long bytes;	/* allocated in total */
+	long long live;		/* allocated and not freed yet */
+	long long peak;		/* highest @live */
+	long refused;		/* allocations over the budget */
+};
+
+int mem_enable(void);
+struct mem_account *mem_set_account(struct mem_account *a);
+struct mem_account *mem_current(void);
+int mem_charge(struct mem_account *a, long long delta);
+
+void *mem_malloc(size_t size);
+void *mem_calloc(size_t n, size_t size);
+void *mem_realloc(void *ptr, size_t size);
+void mem_free(void *ptr);
+
+void mem_add(struct mem_account *to, const struct mem_account *from);
+void mem_print(FILE *f, const char *name, const struct mem_account *a);
+
+#endif
@@ -0,0 +1,14 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - mkv.h
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ */
+
+#ifndef JPSUB_MKV_H
+#define JPSUB_MKV_H
+
+struct srt_file;
+
+int mkv_open(struct srt_file *srt, const char *path);
+
+#endif
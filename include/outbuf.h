@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - outbuf.h
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ */
+
+#ifndef JPSUB_OUTBUF_H
+#define JPSUB_OUTBUF_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+ * Output buffer - text formatted in memory and written out in large
+ * blocks. A failed allocation marks the buffer as failed and later
+ * output is dropped, like a stream error, so callers check once at the
+ * end.
+ */
+struct outbuf {
+	char *data;
+	size_t len;
+	size_t cap;
+	int failed;
+};
+
+void outbuf_init(struct outbuf *ob);
+void outbuf_put(struct outbuf *ob, const char *s, size_t len);
+void outbuf_puts(struct outbuf *ob, const char *s);
+void outbuf_int(struct outbuf *ob, int n);
+void outbuf_fixed1(struct outbuf *ob, float x);
+int outbuf_flush(struct outbuf *ob, FILE *f);
+char *outbuf_release(struct outbuf *ob, size_t *len);
+void outbuf_free(struct outbuf *ob);
+
+#endif
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - queue.h
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ */
+
+#ifndef JPSUB_QUEUE_H
+#define JPSUB_QUEUE_H
+
+#include <pthread.h>
+
+/*
+ * Bounded blocking queue connecting two pipeline stages. Producers block
+ * while it is full, which keeps the number of items in flight capped.
+ */
+struct queue {
+	void **items;
+	int capacity;
+	int head;
+	int count;
+	int producers;		/* producers that have not closed yet */
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+
+	/* Occupancy, for the pipeline report */
+	double last_change;
+	double depth_area;	/* integral of count over time */
+	double full_wait;	/* time producers spent blocked */
+	double empty_wait;	/* time consumers spent blocked */
+	long pushed;
+};
+
+int queue_init(struct queue *q, int capacity, int producers);
+void queue_destroy(struct queue *q);
+int queue_push(struct queue *q, void *item);
+void *queue_pop(struct queue *q);
+void *queue_pop_cancel(struct queue *q, int (*cancel)(void *), void *arg);
+void queue_wake(struct queue *q);
+int queue_drained(struct queue *q);
+void queue_close(struct queue *q);
+
+#endif
@@ -7,8 +7,43 @@
 #ifndef JPSUB_SRT_H
 #define JPSUB_SRT_H
 
+#include <stdio.h>
+#include <stddef.h>
 #include "types.h"
 
-struct subtitle *parse_srt(const char *path, int *count);
+/*
+ * SRT file - the cues of a mapped file. Their text points into the
+ * mapping, which is private, so CRLF cues are normalized in place.
+ * Cues read from another container or from an archive point into @text
+ * instead.
+ */
+struct srt_file {
+	struct subtitle *subs;
+	int count;
+	char *map;
+	size_t map_len;
+	char *text;
+};
+
+int srt_open(struct srt_file *srt, const char *path);
+int srt_parse(struct srt_file *srt, char *buf, size_t len, const char *name);
+void srt_close(struct srt_file *srt);
+
+/*
+ * SRT stream - reads the cues of a pipe one at a time, so the whole
+ * input never has to be held in memory
+ */
+struct srt_stream {
+	FILE *f;
+	const char *name;	/* for diagnostics */
+	int lineno;
+	char *line;
+	size_t line_cap;
+};
+
+void srt_stream_init(struct srt_stream *st, FILE *f, const char *name);
+int srt_stream_next(struct srt_stream *st, struct subtitle *sub, char **buf,
+		    size_t *cap);
+void srt_stream_free(struct srt_stream *st);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - stats.h
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ */
+
+#ifndef JPSUB_STATS_H
+#define JPSUB_STATS_H
+
+#include <stdio.h>
+#include "types.h"
+
+enum stats_timer {
+	STATS_WALK,		/* finding and sorting the inputs */
+	STATS_PARSE,		/* reading and parsing an input */
+	STATS_MECAB,		/* MeCab lattice parsing */
+	STATS_READINGS,		/* readings taken from the MeCab nodes */
+	STATS_LAYOUT,		/* caches, placing and formatting events */
+	STATS_WRITE,		/* writing the output */
+	NR_STATS_TIMERS
+};
+
+/*
+ * Conversion stats - time spent in each stage, in seconds of thread
+ * time, and what went through it, for one file or a whole run
+ */
+struct conv_stats {
+	double seconds[NR_STATS_TIMERS];
+	long files;
+	long cues;
+	long lines;		/* non-empty lines of the cues */
+	long nodes;		/* MeCab nodes looked at */
+	long tokens;		/* furigana written */
+	long long bytes_read;	/* size of the input */
+	long long bytes_written;
+};
+
+void stats_add(struct conv_stats *to, const struct conv_stats *from);
+long stats_count_lines(const struct subtitle *subs, int count);
+void stats_print(FILE *f, const struct conv_stats *st, double wall);
+void stats_print_json(FILE *f, const char *path, const struct conv_stats *st,
+		      double wall);
+
+#endif
@@ -7,15 +7,31 @@
 #ifndef JPSUB_TYPES_H
 #define JPSUB_TYPES_H
 
-#include <wchar.h>
+#include <stddef.h>
+
+#define JPSUB_VERSION		"1.1.0"
 
 /*
  * Buffer and capacity constants
  */
 #define INITIAL_SUB_CAPACITY	128
-#define INITIAL_TOKEN_CAPACITY	64
-#define MAX_LINE		2048
+#define ASS_CHUNK_CUES		64
+#define ASS_STREAM_WINDOW	8
+#define ASS_IOV_BATCH		16	/* _XOPEN_IOV_MAX */
+#define OUTBUF_INITIAL_SIZE	4096
+#define OUTBUF_FLUSH_SIZE	65536
+#define PARSE_QUEUE_DEPTH	16
+#define ANALYZE_QUEUE_DEPTH	8
+#define WRITE_QUEUE_DEPTH	8
+#define LINE_CACHE_ENTRIES	65536
+#define READING_CACHE_SLOTS	4096
+#define READING_CACHE_TEXT	48
+#define ARENA_BLOCK_SIZE	16384
 #define JPSUB_MAX_PATH		512
+#define WALK_THREADS		4
+#define WALK_OPEN_DIRS		256
+#define MKV_READ_WINDOW		4096
+#define ARCHIVE_HELD_BYTES	(32 << 20)	/* compressed tar members */
 #define MAX_TIME		32
 
 /*
@@ -28,7 +44,8 @@
 /*
  * MeCab field indices
  */
-#define MECAB_READING_FIELD	7
+#define MECAB_READING_FIELD	7	/* IPAdic */
+#define UNIDIC_READING_FIELD	17	/* UniDic 2.1 kana */
 
 /*
  * Furigana token - represents a single furigana annotation
@@ -42,12 +59,14 @@ struct furigana_token {
 };
 
 /*
- * Subtitle entry - a single subtitle with timing and text
+ * Subtitle entry - a single subtitle with timing and text. The text is
+ * a view of its lines, separated by '\n' and not NUL-terminated.
  */
 struct subtitle {
 	int start_ms;
 	int end_ms;
-	char *text;
+	const char *text;
+	size_t len;
 };
 
 /*
@@ -63,6 +82,7 @@ struct font_config {
 	int furigana_offset;
 	float char_width;
 	int line_spacing;
+	int packed_furigana;	/* one furigana event per line */
 };
 
 #endif
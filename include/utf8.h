@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - utf8.h
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ */
+
+#ifndef JPSUB_UTF8_H
+#define JPSUB_UTF8_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Decoding */
+size_t utf8_decode(const char *s, size_t len, uint32_t *cp);
+size_t utf8_decode_last(const char *s, size_t len, uint32_t *cp);
+size_t utf8_count(const char *s, size_t len);
+size_t utf8_count_scalar(const char *s, size_t len);
+
+/* Classification */
+int utf8_is_kanji(uint32_t c);
+int utf8_has_kanji(const char *s, size_t len);
+int utf8_is_hiragana(uint32_t c);
+int utf8_is_katakana(uint32_t c);
+
+/* Transformation */
+void utf8_katakana_to_hiragana(char *s, size_t len);
+
+#endif
@@ -7,25 +7,32 @@
 #ifndef JPSUB_UTILS_H
 #define JPSUB_UTILS_H
 
-#include <wchar.h>
-#include <mecab.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
 #include "types.h"
 
-/* Unicode helpers */
-int count_unicode_chars(const char *s);
-int is_kanji(wchar_t c);
+/* Hashing */
+#define HASH_SEED	0xcbf29ce484222325ULL
+
+uint64_t hash_bytes(const void *data, size_t len, uint64_t h);
+int hash_file(const char *path, uint64_t *hash);
 
 /* Time formatting */
-void format_ass_time(int ms, char *buf);
+int format_ass_time(int ms, char *buf);
+double monotonic_seconds(void);
 
 /* File operations */
 int ends_with_srt(const char *path);
-void process_file(const char *path, struct font_config *cfg, mecab_t *mecab);
-void scan_directory(const char *dir, struct font_config *cfg, mecab_t *mecab);
+int ends_with_mkv(const char *path);
+int is_archive(const char *path);
+int is_subtitle_input(const char *path);
+int make_parent_dirs(const char *path);
 
 /* Configuration */
 struct font_config *get_default_config(void);
 struct font_config *create_scaled_config(int main_size);
+uint64_t config_hash(const struct font_config *cfg);
 
 /* UI */
 void print_banner(void);
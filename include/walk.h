@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - walk.h
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ */
+
+#ifndef JPSUB_WALK_H
+#define JPSUB_WALK_H
+
+#include <sys/stat.h>
+
+/*
+ * Called for every subtitle input found, from any walker thread
+ */
+typedef int (*walk_fn)(const char *path, const struct stat *st, void *data);
+
+/*
+ * Walk counters, added up over every walk they are passed to
+ */
+struct walk_stats {
+	long dirs;		/* directories read */
+	long entries;		/* directory entries seen */
+	long stats;		/* entries whose type took an fstatat() */
+	long files;		/* subtitle inputs found */
+	double seconds;
+};
+
+void walk_tree(const char *root, int nthreads, walk_fn fn, void *data,
+	       struct walk_stats *stats);
+
+#endif
@@ -8,54 +8,309 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <locale.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <mecab.h>
+#include <errno.h>
+#include <limits.h>
 
 #include "types.h"
 #include "utils.h"
 #include "mecab_helpers.h"
-#include "srt.h"
-#include "ass.h"
+#include "batch.h"
+#include "disk_cache.h"
+#include "mem.h"
+
+#define DEFAULT_MANIFEST	".furigana4subtitles.manifest"
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] file.srt|file.mkv|archive|directory [...]\n"
+		"       %s [options] - < in.srt > out.ass\n"
+		"       %s --disk-cache FILE --compact-cache\n"
+		"\n"
+		"Options:\n"
+		"  -j N           analyzer threads (default: online CPUs)\n"
+		"  --walkers N    folder walking threads (default: %d)\n"
+		"  --parsers N    parser threads (default: 2)\n"
+		"  --writers N    writer threads (default: 1)\n"
+		"  --cache-lines N\n"
+		"                 lines to memoize, 0 to disable (default: %d)\n"
+		"  --disk-cache FILE\n"
+		"                 keep readings in FILE across runs\n"
+		"  --reading-field ipadic|unidic|N\n"
+		"                 feature field holding readings (default: ipadic)\n"
+		"  --compact-cache\n"
+		"                 rewrite the disk cache without stale entries\n"
+		"  --incremental  skip inputs whose output is up to date\n"
+		"  --manifest FILE\n"
+		"                 manifest for --incremental (default: %s)\n"
+		"  --zip-output   put the outputs of an archive in NAME.ass.zip\n"
+		"  --pack-furigana\n"
+		"                 one furigana event per line instead of per word\n"
+		"  --report       print pipeline stage occupancy\n"
+		"  --stats        print time and counters of each stage, per file\n"
+		"                 and for the whole run\n"
+		"  --stats-json FILE\n"
+		"                 write the same stats to FILE as JSON lines\n"
+		"  --mem-stats    print allocations and peak memory of each stage\n"
+		"  --mem-budget SIZE\n"
+		"                 fail files holding more than SIZE bytes (K, M, G)\n",
+		prog, prog, prog, WALK_THREADS, LINE_CACHE_ENTRIES, DEFAULT_MANIFEST);
+}
+
+static int parse_count(const char *arg, long min, long max, int *out)
+{
+	char *end;
+	long n;
+
+	if (!arg)
+		return -1;
+
+	n = strtol(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || n < min || n > max)
+		return -1;
+
+	*out = (int)n;
+	return 0;
+}
+
+/*
+ * Parse a byte count, with an optional K, M or G suffix.
+ */
+static int parse_size(const char *arg, long long *out)
+{
+	char *end;
+	long long n;
+	int shift = 0;
+
+	if (!arg)
+		return -1;
+
+	n = strtoll(arg, &end, 10);
+	if (*end == 'K' || *end == 'k')
+		shift = 10;
+	else if (*end == 'M' || *end == 'm')
+		shift = 20;
+	else if (*end == 'G' || *end == 'g')
+		shift = 30;
+	if (shift)
+		end++;
+
+	if (*arg == '\0' || *end != '\0' || n <= 0 || n > (LLONG_MAX >> shift))
+		return -1;
+
+	*out = n << shift;
+	return 0;
+}
+
+/*
+ * Parse the leading options. Returns the index of the first path, or -1
+ * on a bad option.
+ */
+static int parse_options(int argc, char **argv, struct batch_opts *opts,
+			 int *compact, int *pack)
+{
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+		const char *opt = argv[i];
+		int *count = NULL;
+		long min = 1, max = 1024;
+		const char *what = "thread count";
+		const char *val;
+
+		if (strcmp(opt, "--") == 0)
+			return i + 1;
+
+		if (strcmp(opt, "--report") == 0) {
+			opts->report = 1;
+			continue;
+		}
+
+		if (strcmp(opt, "--stats") == 0) {
+			opts->stats = 1;
+			continue;
+		}
+
+		if (strcmp(opt, "--mem-stats") == 0) {
+			opts->mem_stats = 1;
+			continue;
+		}
+
+		if (strcmp(opt, "--mem-budget") == 0) {
+			if (parse_size(++i < argc ? argv[i] : NULL,
+				       &opts->mem_budget) < 0) {
+				fprintf(stderr, "Invalid size for %s\n", opt);
+				return -1;
+			}
+			continue;
+		}
+
+		if (strcmp(opt, "--pack-furigana") == 0) {
+			*pack = 1;
+			continue;
+		}
+
+		if (strcmp(opt, "--zip-output") == 0) {
+			opts->zip_output = 1;
+			continue;
+		}
+
+		if (strcmp(opt, "--compact-cache") == 0) {
+			*compact = 1;
+			continue;
+		}
+
+		if (strcmp(opt, "--reading-field") == 0) {
+			if (++i < argc)
+				opts->reading_field =
+					parse_reading_field(argv[i]);
+			if (i >= argc || opts->reading_field < 0) {
+				fprintf(stderr, "Invalid field for %s\n", opt);
+				return -1;
+			}
+			continue;
+		}
+
+		if (strcmp(opt, "--incremental") == 0) {
+			if (!opts->manifest)
+				opts->manifest = DEFAULT_MANIFEST;
+			continue;
+		}
+
+		if (strcmp(opt, "--disk-cache") == 0 ||
+		    strcmp(opt, "--manifest") == 0 ||
+		    strcmp(opt, "--stats-json") == 0) {
+			const char **file = opt[2] == 'd' ? &opts->disk_cache :
+					    opt[2] == 'm' ? &opts->manifest :
+							    &opts->stats_json;
+
+			if (++i >= argc) {
+				fprintf(stderr, "Missing file for %s\n", opt);
+				return -1;
+			}
+			*file = argv[i];
+			continue;
+		}
+
+		if (strncmp(opt, "-j", 2) == 0) {
+			count = &opts->analyzers;
+			val = opt[2] ? opt + 2 : argv[++i];
+		} else if (strcmp(opt, "--walkers") == 0) {
+			count = &opts->walkers;
+			val = argv[++i];
+		} else if (strcmp(opt, "--parsers") == 0) {
+			count = &opts->parsers;
+			val = argv[++i];
+		} else if (strcmp(opt, "--writers") == 0) {
+			count = &opts->writers;
+			val = argv[++i];
+		} else if (strcmp(opt, "--cache-lines") == 0) {
+			count = &opts->cache_lines;
+			min = 0;
+			max = 1 << 24;
+			what = "line count";
+			val = argv[++i];
+		} else {
+			fprintf(stderr, "Unknown option: %s\n", opt);
+			return -1;
+		}
+
+		if (parse_count(i < argc ? val : NULL, min, max, count) < 0) {
+			fprintf(stderr, "Invalid %s for %s\n", what, opt);
+			return -1;
+		}
+	}
+	return i;
+}
+
+static int compact_cache(const char *path, mecab_model_t *model, int field)
+{
+	long kept, dropped;
+
+	if (disk_cache_compact(path, dictionary_fingerprint(model, field),
+			       &kept, &dropped) < 0) {
+		fprintf(stderr, "Cannot compact %s: %s\n", path,
+			strerror(errno));
+		return -1;
+	}
+
+	printf("Compacted %s: %ld records kept, %ld dropped\n", path, kept,
+	       dropped);
+	return 0;
+}
 
 int main(int argc, char **argv)
 {
-	mecab_t *mecab;
+	struct batch b = {0};
+	struct batch_opts opts;
+	mecab_model_t *model;
 	struct font_config *cfg;
+	int compact = 0;
+	int pack = 0;
+	int stream;
+	int errors = 0;
+	int failed;
 	int i;
 
-	setlocale(LC_ALL, "");
+	batch_default_opts(&opts);
 
-	if (argc < 2) {
-		fprintf(stderr, "Usage: %s file.srt|directory [...]\n", argv[0]);
+	i = parse_options(argc, argv, &opts, &compact, &pack);
+	if (i < 0 || (i >= argc && !compact) ||
+	    (compact && !opts.disk_cache)) {
+		usage(argv[0]);
 		return 1;
 	}
 
-	print_banner();
+	/* Nothing must be allocated through mem_malloc() before this */
+	if ((opts.mem_stats || opts.mem_budget) && mem_enable() < 0) {
+		fprintf(stderr, "Cannot enable memory accounting\n");
+		return 1;
+	}
 
-	mecab = mecab_new2("");
-	if (!mecab) {
-		fprintf(stderr, "MeCab initialization failed\n");
+	/* Standard output carries the subtitles, so nothing else goes there */
+	stream = i == argc - 1 && strcmp(argv[i], "-") == 0;
+	if (stream && compact) {
+		usage(argv[0]);
 		return 1;
 	}
 
+	if (!stream)
+		print_banner();
+
+	model = load_mecab_model();
+	if (!model)
+		return 1;
+
 	cfg = get_default_config();
+	cfg->packed_furigana = pack;
 
-	for (i = 1; i < argc; i++) {
-		struct stat st;
+	if (stream) {
+		failed = batch_stream(cfg, model, &opts);
+		mecab_model_destroy(model);
+		return failed ? 1 : 0;
+	}
 
-		if (stat(argv[i], &st) != 0) {
-			fprintf(stderr, "Cannot access: %s\n", argv[i]);
+	if (compact && compact_cache(opts.disk_cache, model,
+				 opts.reading_field) < 0)
+		errors++;
+
+	for (; i < argc; i++) {
+		if (strcmp(argv[i], "-") == 0) {
+			fprintf(stderr, "Standard input must be the only "
+				"input\n");
+			errors++;
 			continue;
 		}
-
-		if (S_ISDIR(st.st_mode))
-			scan_directory(argv[i], cfg, mecab);
-		else if (ends_with_srt(argv[i]))
-			process_file(argv[i], cfg, mecab);
+		if (batch_add_path(&b, argv[i]) < 0) {
+			fprintf(stderr, "Cannot access: %s\n", argv[i]);
+			errors++;
+		}
 	}
 
-	mecab_destroy(mecab);
-	return 0;
+	failed = batch_run(&b, cfg, model, &opts);
+	batch_free(&b);
+	mecab_model_destroy(model);
+
+	return (errors || failed) ? 1 : 0;
 }
@@ -6,7 +6,6 @@
  * Interactive CLI for converting SRT subtitles to ASS with furigana.
  */
 
-#include <locale.h>
 #include "cli.h"
 
 int main(void)
@@ -14,8 +13,6 @@ int main(void)
 	struct cli_ctx ctx = {0};
 	int ret;
 
-	setlocale(LC_ALL, "");
-
 	if (cli_init(&ctx) < 0)
 		return 1;
 
@@ -0,0 +1,967 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - archive.c
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ *
+ * Lists and reads the SRT members of zip and tar archives, so they are
+ * converted without being extracted to disk first.
+ *
+ * A zip file is listed from its central directory alone, and a member
+ * is read with a pread of its local header and one of its data, which
+ * is inflated in memory. A plain tar file is listed by stepping from
+ * header to header, and members are read in place later. A compressed
+ * tar file cannot be read out of order: the lister may take a member's
+ * contents with archive_load() as the listing goes through it, and a
+ * member it leaves is decompressed again from the start of the archive
+ * when it is read. Holding members costs memory, leaving them costs a
+ * pass over the archive each, so the lister decides how much to hold.
+ *
+ * The outputs of an archive can also be collected in a zip file, which
+ * is written in one go, sorted by name, once all of them are in.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "archive.h"
+#include "types.h"
+#include "utils.h"
+#include "mem.h"
+
+#define ZIP_LOCAL_SIG		0x04034b50
+#define ZIP_CENTRAL_SIG		0x02014b50
+#define ZIP_END_SIG		0x06054b50
+#define ZIP_LOCAL_SIZE		30
+#define ZIP_CENTRAL_SIZE	46
+#define ZIP_END_SIZE		22
+#define ZIP_COMMENT_MAX		65535
+#define ZIP_ENCRYPTED		0x0001
+#define ZIP_UTF8		0x0800
+#define ZIP_STORED		0
+#define ZIP_DEFLATED		8
+#define ZIP_VERSION		20	/* 2.0, for deflate */
+#define ZIP_MADE_BY_UNIX	(3 << 8 | ZIP_VERSION)
+#define ZIP_MAX_32		0xFFFFFFFFu
+
+#define TAR_BLOCK		512
+#define TAR_META_MAX		65536	/* long name or pax header */
+
+static unsigned get16(const unsigned char *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+	       (uint32_t)p[3] << 24;
+}
+
+static unsigned char *put16(unsigned char *p, unsigned v)
+{
+	p[0] = v & 0xFF;
+	p[1] = v >> 8 & 0xFF;
+	return p + 2;
+}
+
+static unsigned char *put32(unsigned char *p, uint32_t v)
+{
+	p[0] = v & 0xFF;
+	p[1] = v >> 8 & 0xFF;
+	p[2] = v >> 16 & 0xFF;
+	p[3] = v >> 24 & 0xFF;
+	return p + 4;
+}
+
+/*
+ * Read exactly @len bytes at @off. A short read means the archive is
+ * truncated.
+ */
+static int pread_full(int fd, void *buf, size_t len, off_t off)
+{
+	char *p = buf;
+
+	while (len > 0) {
+		ssize_t n = pread(fd, p, len, off);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		p += n;
+		off += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * Outputs are written below the folder of the archive: skip absolute
+ * names and names that climb out of it.
+ */
+static int wanted_member(const char *name)
+{
+	const char *p = name;
+
+	if (*name == '/' || !ends_with_srt(name))
+		return 0;
+
+	for (;;) {
+		const char *slash = strchr(p, '/');
+		size_t len = slash ? (size_t)(slash - p) : strlen(p);
+
+		if (len == 2 && p[0] == '.' && p[1] == '.')
+			return 0;
+		if (!slash)
+			return 1;
+		p = slash + 1;
+	}
+}
+
+/*
+ * Find the end of central directory record in the last bytes of the
+ * file, where it sits before an optional comment.
+ */
+static int zip_find_end(int fd, off_t size, unsigned char *end)
+{
+	size_t len = size < ZIP_END_SIZE + ZIP_COMMENT_MAX ?
+		     (size_t)size : ZIP_END_SIZE + ZIP_COMMENT_MAX;
+	unsigned char *tail;
+	size_t i;
+
+	if (len < ZIP_END_SIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	tail = malloc(len);
+	if (!tail)
+		return -1;
+	if (pread_full(fd, tail, len, size - len) < 0) {
+		free(tail);
+		return -1;
+	}
+
+	for (i = len - ZIP_END_SIZE + 1; i-- > 0;) {
+		if (get32(tail + i) == ZIP_END_SIG) {
+			memcpy(end, tail + i, ZIP_END_SIZE);
+			free(tail);
+			return 0;
+		}
+	}
+
+	free(tail);
+	errno = EINVAL;
+	return -1;
+}
+
+static int zip_list(int fd, off_t size, archive_fn fn, void *data)
+{
+	unsigned char end[ZIP_END_SIZE], *cd, *p, *cd_end;
+	uint32_t cd_size, cd_off;
+	unsigned entries, i;
+	int ret = 0;
+
+	if (zip_find_end(fd, size, end) < 0)
+		return -1;
+
+	entries = get16(end + 10);
+	cd_size = get32(end + 12);
+	cd_off = get32(end + 16);
+
+	/* Bundles of subtitles never need the 64-bit extensions */
+	if (entries == 0xFFFF || cd_size == ZIP_MAX_32 ||
+	    cd_off == ZIP_MAX_32) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	if ((off_t)cd_off + cd_size > size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	cd = malloc(cd_size ? cd_size : 1);
+	if (!cd)
+		return -1;
+	if (pread_full(fd, cd, cd_size, cd_off) < 0) {
+		free(cd);
+		return -1;
+	}
+
+	cd_end = cd + cd_size;
+	for (p = cd, i = 0; i < entries && ret == 0; i++) {
+		struct archive_member m;
+		unsigned flags, method, nlen, xlen, clen;
+		char *name;
+
+		if (cd_end - p < ZIP_CENTRAL_SIZE ||
+		    get32(p) != ZIP_CENTRAL_SIG) {
+			errno = EINVAL;
+			ret = -1;
+			break;
+		}
+
+		flags = get16(p + 8);
+		method = get16(p + 10);
+		nlen = get16(p + 28);
+		xlen = get16(p + 30);
+		clen = get16(p + 32);
+		if ((size_t)(cd_end - p) < ZIP_CENTRAL_SIZE + nlen + xlen +
+					    clen) {
+			errno = EINVAL;
+			ret = -1;
+			break;
+		}
+
+		name = malloc(nlen + 1);
+		if (!name) {
+			ret = -1;
+			break;
+		}
+		memcpy(name, p + ZIP_CENTRAL_SIZE, nlen);
+		name[nlen] = '\0';
+
+		memset(&m, 0, sizeof(m));
+		m.name = name;
+		m.method = method == ZIP_STORED ? MEMBER_ZIP_STORED :
+						  MEMBER_ZIP_DEFLATED;
+		m.crc = get32(p + 16);
+		m.size = get32(p + 20);
+		m.usize = get32(p + 24);
+		m.offset = get32(p + 42);
+
+		if (!(flags & ZIP_ENCRYPTED) && wanted_member(name) &&
+		    (method == ZIP_STORED || method == ZIP_DEFLATED))
+			ret = fn(&m, data);
+
+		free(name);
+		p += ZIP_CENTRAL_SIZE + nlen + xlen + clen;
+	}
+
+	free(cd);
+	return ret;
+}
+
+/*
+ * Numeric tar fields are octal, or base-256 when the first byte has its
+ * high bit set. Returns -1 if the field is not a number.
+ */
+static int64_t tar_number(const unsigned char *p, size_t len)
+{
+	int64_t v = 0;
+	size_t i = 0;
+
+	if (p[0] & 0x80) {
+		v = p[0] & 0x3F;
+		for (i = 1; i < len; i++) {
+			if (v > INT64_MAX >> 8)
+				return -1;
+			v = v << 8 | p[i];
+		}
+		return v;
+	}
+
+	while (i < len && p[i] == ' ')
+		i++;
+	for (; i < len && p[i] >= '0' && p[i] <= '7'; i++) {
+		if (v > INT64_MAX >> 3)
+			return -1;
+		v = v << 3 | (p[i] - '0');
+	}
+	if (i < len && p[i] != ' ' && p[i] != '\0')
+		return -1;
+	return v;
+}
+
+static int tar_checksum_ok(const unsigned char *hdr)
+{
+	int64_t sum = 0, want = tar_number(hdr + 148, 8);
+	int i;
+
+	for (i = 0; i < TAR_BLOCK; i++)
+		sum += i >= 148 && i < 156 ? ' ' : hdr[i];
+	return sum == want;
+}
+
+/*
+ * The path a pax extended header gives the next member, if any.
+ * Records are "<length> <key>=<value>\n".
+ */
+static char *pax_path(const char *buf, size_t len)
+{
+	size_t off = 0;
+
+	while (off < len) {
+		const char *rec = buf + off, *key;
+		size_t reclen = 0;
+
+		while (off < len && reclen <= len && buf[off] >= '0' &&
+		       buf[off] <= '9')
+			reclen = reclen * 10 + (buf[off++] - '0');
+		if (reclen == 0 || off >= len || rec + reclen > buf + len ||
+		    buf[off] != ' ')
+			return NULL;
+
+		key = buf + off + 1;
+		if (rec + reclen - key > 5 && memcmp(key, "path=", 5) == 0)
+			return strndup(key + 5, rec + reclen - key - 6);
+		off = rec + reclen - buf;
+	}
+	return NULL;
+}
+
+/*
+ * Name of a ustar member: its prefix field, if any, then its name.
+ */
+static char *tar_name(const unsigned char *hdr)
+{
+	size_t plen = 0, nlen = strnlen((const char *)hdr, 100);
+	char *name;
+
+	if (memcmp(hdr + 257, "ustar", 5) == 0)
+		plen = strnlen((const char *)hdr + 345, 155);
+
+	name = malloc(plen + nlen + 2);
+	if (!name)
+		return NULL;
+
+	memcpy(name, hdr + 345, plen);
+	if (plen)
+		name[plen++] = '/';
+	memcpy(name + plen, hdr, nlen);
+	name[plen + nlen] = '\0';
+	return name;
+}
+
+static int gz_skip(gzFile gz, int64_t len)
+{
+	return len > 0 && gzseek(gz, (z_off_t)len, SEEK_CUR) < 0 ? -1 : 0;
+}
+
+/*
+ * Hand @m to @fn, which may take the contents of a compressed tar now
+ * with archive_load(), then move on to the next header.
+ */
+static int tar_member(gzFile gz, struct archive_member *m, int64_t padded,
+		      archive_fn fn, void *data)
+{
+	int ret;
+
+	m->method = gzdirect(gz) ? MEMBER_TAR : MEMBER_TAR_GZ;
+	m->offset = gztell(gz);
+	m->stream = gz;
+	ret = fn(m, data);
+	m->stream = NULL;
+	mem_free(m->data);
+
+	if (ret == 0 && gzseek(gz, (z_off_t)(m->offset + padded),
+			       SEEK_SET) < 0) {
+		errno = EINVAL;
+		ret = -1;
+	}
+	return ret;
+}
+
+/*
+ * Decompress member @m of the compressed tar being listed into a
+ * buffer from mem_malloc(), in m->data. Only valid from the callback of
+ * archive_list(), before anything else is read. Returns -1 with errno
+ * set on failure; the member can still be read later.
+ */
+int archive_load(struct archive_member *m)
+{
+	if (m->method != MEMBER_TAR_GZ || !m->stream) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (m->usize > INT_MAX) {
+		errno = EFBIG;
+		return -1;
+	}
+
+	m->data = mem_malloc(m->usize ? m->usize : 1);
+	if (!m->data)
+		return -1;
+	if (gzread(m->stream, m->data, m->usize) != (int)m->usize) {
+		mem_free(m->data);
+		m->data = NULL;
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+static int tar_list(const char *path, archive_fn fn, void *data)
+{
+	unsigned char hdr[TAR_BLOCK];
+	char *long_name = NULL, *meta = NULL;
+	gzFile gz;
+	int ret = 0;
+
+	gz = gzopen(path, "rb");
+	if (!gz)
+		return -1;
+
+	for (;;) {
+		struct archive_member m;
+		int64_t size, padded;
+		char *name;
+		int n = gzread(gz, hdr, TAR_BLOCK);
+
+		/* Two zero blocks end the archive, but EOF will do too */
+		if (n == 0 || (n == TAR_BLOCK && hdr[0] == '\0'))
+			break;
+		if (n != TAR_BLOCK || !tar_checksum_ok(hdr)) {
+			errno = EINVAL;
+			ret = -1;
+			break;
+		}
+
+		size = tar_number(hdr + 124, 12);
+		if (size < 0 || (uint64_t)size > SIZE_MAX - TAR_BLOCK) {
+			errno = EINVAL;
+			ret = -1;
+			break;
+		}
+		padded = (size + TAR_BLOCK - 1) & ~(int64_t)(TAR_BLOCK - 1);
+
+		/* GNU long names and pax headers describe the next member */
+		if (hdr[156] == 'L' || hdr[156] == 'x') {
+			if (size > TAR_META_MAX) {
+				errno = EINVAL;
+				ret = -1;
+				break;
+			}
+			meta = malloc(padded ? padded : 1);
+			if (!meta || gzread(gz, meta, padded) != padded) {
+				errno = meta ? EINVAL : ENOMEM;
+				ret = -1;
+				break;
+			}
+			free(long_name);
+			long_name = hdr[156] == 'L' ?
+				    strndup(meta, size) :
+				    pax_path(meta, size);
+			free(meta);
+			meta = NULL;
+			continue;
+		}
+
+		name = long_name ? long_name : tar_name(hdr);
+		long_name = NULL;
+		if (!name) {
+			ret = -1;
+			break;
+		}
+
+		if ((hdr[156] == '0' || hdr[156] == '\0') &&
+		    wanted_member(name)) {
+			memset(&m, 0, sizeof(m));
+			m.name = name;
+			m.size = m.usize = size;
+			ret = tar_member(gz, &m, padded, fn, data);
+		} else if (gz_skip(gz, padded) < 0) {
+			errno = EINVAL;
+			ret = -1;
+		}
+
+		free(name);
+		if (ret < 0)
+			break;
+	}
+
+	free(meta);
+	free(long_name);
+	gzclose(gz);
+	return ret;
+}
+
+/*
+ * Call @fn on every SRT member of the zip or tar (possibly compressed)
+ * archive at @path. The member is only valid during the call, except
+ * for data @fn loaded, which it may take by setting it to NULL.
+ * Returns -1 with errno set if the archive cannot be read or @fn fails.
+ */
+int archive_list(const char *path, archive_fn fn, void *data)
+{
+	unsigned char magic[4];
+	struct stat st;
+	int fd, ret, err;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	/* Tell the formats apart by content, whatever the extension */
+	if (st.st_size >= 4 && pread_full(fd, magic, 4, 0) == 0 &&
+	    magic[0] == 'P' && magic[1] == 'K' &&
+	    (get32(magic) == ZIP_LOCAL_SIG || get32(magic) == ZIP_END_SIG)) {
+		ret = zip_list(fd, st.st_size, fn, data);
+		err = errno;
+		close(fd);
+		errno = err;
+		return ret;
+	}
+
+	close(fd);
+	return tar_list(path, fn, data);
+}
+
+static int inflate_member(const unsigned char *in, size_t len, char *out,
+			  size_t usize)
+{
+	z_stream zs;
+	int ret;
+
+	if (len > UINT_MAX || usize > UINT_MAX) {
+		errno = EFBIG;
+		return -1;
+	}
+
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, -MAX_WBITS) != Z_OK) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	zs.next_in = (unsigned char *)in;
+	zs.avail_in = len;
+	zs.next_out = (unsigned char *)out;
+	zs.avail_out = usize;
+	ret = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+
+	if (ret != Z_STREAM_END || zs.avail_out != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Decompress the archive at @path again up to member @m, then the
+ * member itself.
+ */
+static int tar_gz_read(const char *path, const struct archive_member *m,
+		       char *buf)
+{
+	gzFile gz;
+	int ret = 0;
+
+	if (m->usize > INT_MAX) {
+		errno = EFBIG;
+		return -1;
+	}
+
+	gz = gzopen(path, "rb");
+	if (!gz)
+		return -1;
+	if (gzseek(gz, (z_off_t)m->offset, SEEK_SET) < 0 ||
+	    gzread(gz, buf, m->usize) != (int)m->usize) {
+		errno = EINVAL;
+		ret = -1;
+	}
+	gzclose(gz);
+	return ret;
+}
+
+static int zip_read(int fd, const struct archive_member *m, char *buf)
+{
+	unsigned char local[ZIP_LOCAL_SIZE], *comp;
+	off_t off;
+	int ret;
+
+	if (pread_full(fd, local, ZIP_LOCAL_SIZE, m->offset) < 0)
+		return -1;
+	if (get32(local) != ZIP_LOCAL_SIG) {
+		errno = EINVAL;
+		return -1;
+	}
+	off = m->offset + ZIP_LOCAL_SIZE + get16(local + 26) +
+	      get16(local + 28);
+
+	if (m->method == MEMBER_ZIP_STORED) {
+		if (m->size != m->usize) {
+			errno = EINVAL;
+			return -1;
+		}
+		return pread_full(fd, buf, m->usize, off);
+	}
+
+	comp = mem_malloc(m->size ? m->size : 1);
+	if (!comp)
+		return -1;
+	ret = pread_full(fd, comp, m->size, off);
+	if (ret == 0)
+		ret = inflate_member(comp, m->size, buf, m->usize);
+	mem_free(comp);
+	return ret;
+}
+
+/* Read member @m of a zip or plain tar, at its offset */
+static int member_pread(const char *path, const struct archive_member *m,
+			char *buf)
+{
+	int fd, ret, err;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (m->method == MEMBER_TAR)
+		ret = pread_full(fd, buf, m->usize, m->offset);
+	else
+		ret = zip_read(fd, m, buf);
+	err = errno;
+	close(fd);
+	errno = err;
+	return ret;
+}
+
+/*
+ * Read member @m of the archive at @path into a buffer of its own from
+ * mem_malloc(), returned in @buf, checking the zip CRC. Returns -1 with
+ * errno set on failure.
+ */
+int archive_read(const char *path, struct archive_member *m, char **buf,
+		 size_t *len)
+{
+	int ret, err;
+
+	if (m->data) {
+		*buf = m->data;
+		*len = m->usize;
+		m->data = NULL;
+		return 0;
+	}
+
+	*buf = mem_malloc(m->usize ? m->usize : 1);
+	if (!*buf)
+		return -1;
+
+	if (m->method == MEMBER_TAR_GZ)
+		ret = tar_gz_read(path, m, *buf);
+	else
+		ret = member_pread(path, m, *buf);
+
+	if (ret == 0 && m->method != MEMBER_TAR &&
+	    m->method != MEMBER_TAR_GZ &&
+	    crc32(crc32(0, NULL, 0), (unsigned char *)*buf, m->usize) !=
+	    m->crc) {
+		errno = EINVAL;
+		ret = -1;
+	}
+
+	if (ret < 0) {
+		err = errno;
+		mem_free(*buf);
+		*buf = NULL;
+		errno = err;
+		return -1;
+	}
+	*len = m->usize;
+	return 0;
+}
+
+/*
+ * Output zip entry - deflated while the writers run, written at the end
+ */
+struct zip_entry {
+	char *name;
+	unsigned char *data;
+	size_t size;
+	size_t usize;
+	uint32_t crc;
+};
+
+struct zip_out {
+	char *path;
+	unsigned dos_time;
+	unsigned dos_date;
+	pthread_mutex_t lock;
+	struct zip_entry *entries;
+	int count;
+	int capacity;
+};
+
+/*
+ * Start an output zip at @path. Entries are dated @mtime, so the same
+ * inputs give the same file.
+ */
+struct zip_out *zip_out_new(const char *path, time_t mtime)
+{
+	struct zip_out *z;
+	struct tm tm;
+
+	z = calloc(1, sizeof(*z));
+	if (!z)
+		return NULL;
+
+	z->path = strdup(path);
+	if (!z->path) {
+		free(z);
+		return NULL;
+	}
+
+	/* DOS dates start in 1980 and count seconds by two */
+	if (!localtime_r(&mtime, &tm) || tm.tm_year < 80) {
+		memset(&tm, 0, sizeof(tm));
+		tm.tm_year = 80;
+		tm.tm_mday = 1;
+	}
+	z->dos_date = (tm.tm_year - 80) << 9 | (tm.tm_mon + 1) << 5 |
+		      tm.tm_mday;
+	z->dos_time = tm.tm_hour << 11 | tm.tm_min << 5 | tm.tm_sec / 2;
+
+	pthread_mutex_init(&z->lock, NULL);
+	return z;
+}
+
+const char *zip_out_path(const struct zip_out *z)
+{
+	return z->path;
+}
+
+static int deflate_iov(struct zip_entry *e, const struct iovec *iov, int n)
+{
+	z_stream zs;
+	uLong bound;
+	int i, ret = Z_OK;
+
+	for (i = 0, e->usize = 0; i < n; i++)
+		e->usize += iov[i].iov_len;
+	if (e->usize > ZIP_MAX_32) {
+		errno = EFBIG;
+		return -1;
+	}
+
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+			 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	bound = deflateBound(&zs, e->usize);
+	e->data = mem_malloc(bound);
+	if (!e->data) {
+		deflateEnd(&zs);
+		return -1;
+	}
+
+	e->crc = crc32(0, NULL, 0);
+	zs.next_out = e->data;
+	zs.avail_out = bound;
+	for (i = 0; i <= n && ret == Z_OK; i++) {
+		if (i < n) {
+			zs.next_in = iov[i].iov_base;
+			zs.avail_in = iov[i].iov_len;
+			e->crc = crc32(e->crc, zs.next_in, zs.avail_in);
+		}
+		ret = deflate(&zs, i < n ? Z_NO_FLUSH : Z_FINISH);
+	}
+	e->size = zs.total_out;
+	deflateEnd(&zs);
+
+	if (ret != Z_STREAM_END) {
+		mem_free(e->data);
+		errno = ENOMEM;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Compress the @n buffers of @iov as entry @name. Entries can be added
+ * from any thread.
+ */
+int zip_out_add(struct zip_out *z, const char *name, const struct iovec *iov,
+		int n)
+{
+	struct zip_entry e, *tmp;
+
+	e.name = strdup(name);
+	if (!e.name)
+		return -1;
+	if (deflate_iov(&e, iov, n) < 0) {
+		free(e.name);
+		return -1;
+	}
+
+	pthread_mutex_lock(&z->lock);
+	if (z->count >= z->capacity) {
+		int capacity = z->capacity ? z->capacity * 2 : 16;
+
+		tmp = realloc(z->entries, capacity * sizeof(*tmp));
+		if (!tmp) {
+			pthread_mutex_unlock(&z->lock);
+			mem_free(e.data);
+			free(e.name);
+			return -1;
+		}
+		z->entries = tmp;
+		z->capacity = capacity;
+	}
+	z->entries[z->count++] = e;
+	pthread_mutex_unlock(&z->lock);
+	return 0;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+	return strcmp(((const struct zip_entry *)a)->name,
+		      ((const struct zip_entry *)b)->name);
+}
+
+/*
+ * The fields local and central headers have in common, from the
+ * version needed to the name length.
+ */
+static unsigned char *put_entry_fields(unsigned char *p,
+				       const struct zip_out *z,
+				       const struct zip_entry *e)
+{
+	p = put16(p, ZIP_VERSION);
+	p = put16(p, ZIP_UTF8);
+	p = put16(p, ZIP_DEFLATED);
+	p = put16(p, z->dos_time);
+	p = put16(p, z->dos_date);
+	p = put32(p, e->crc);
+	p = put32(p, e->size);
+	p = put32(p, e->usize);
+	return put16(p, strlen(e->name));
+}
+
+static int write_entries(const struct zip_out *z, FILE *f)
+{
+	unsigned char hdr[ZIP_CENTRAL_SIZE], *p;
+	uint32_t *offsets;
+	uint64_t off = 0, cd_size = 0;
+	int i, ret = -1;
+
+	offsets = malloc((z->count ? z->count : 1) * sizeof(*offsets));
+	if (!offsets)
+		return -1;
+
+	for (i = 0; i < z->count; i++) {
+		const struct zip_entry *e = &z->entries[i];
+		size_t nlen = strlen(e->name);
+
+		if (off > ZIP_MAX_32) {
+			errno = EFBIG;
+			goto out;
+		}
+		offsets[i] = off;
+
+		p = put32(hdr, ZIP_LOCAL_SIG);
+		p = put_entry_fields(p, z, e);
+		p = put16(p, 0);
+		if (fwrite(hdr, 1, p - hdr, f) != (size_t)(p - hdr) ||
+		    fwrite(e->name, 1, nlen, f) != nlen ||
+		    fwrite(e->data, 1, e->size, f) != e->size)
+			goto out;
+		off += ZIP_LOCAL_SIZE + nlen + e->size;
+	}
+
+	for (i = 0; i < z->count; i++) {
+		const struct zip_entry *e = &z->entries[i];
+		size_t nlen = strlen(e->name);
+
+		p = put32(hdr, ZIP_CENTRAL_SIG);
+		p = put16(p, ZIP_MADE_BY_UNIX);
+		p = put_entry_fields(p, z, e);
+		p = put16(p, 0);		/* extra field */
+		p = put16(p, 0);		/* comment */
+		p = put16(p, 0);		/* disk */
+		p = put16(p, 0);		/* internal attributes */
+		p = put32(p, (uint32_t)0100644 << 16);
+		p = put32(p, offsets[i]);
+		if (fwrite(hdr, 1, p - hdr, f) != (size_t)(p - hdr) ||
+		    fwrite(e->name, 1, nlen, f) != nlen)
+			goto out;
+		cd_size += ZIP_CENTRAL_SIZE + nlen;
+	}
+
+	if (off + cd_size > ZIP_MAX_32) {
+		errno = EFBIG;
+		goto out;
+	}
+
+	p = put32(hdr, ZIP_END_SIG);
+	p = put16(p, 0);
+	p = put16(p, 0);
+	p = put16(p, z->count);
+	p = put16(p, z->count);
+	p = put32(p, cd_size);
+	p = put32(p, off);
+	p = put16(p, 0);
+	if (fwrite(hdr, 1, p - hdr, f) == (size_t)(p - hdr))
+		ret = 0;
+out:
+	free(offsets);
+	return ret;
+}
+
+/*
+ * Write the zip file with its entries sorted by name. Returns -1 with
+ * errno set if it could not be written.
+ */
+int zip_out_write(struct zip_out *z)
+{
+	FILE *f;
+	int ret;
+
+	if (z->count >= 0xFFFF) {
+		errno = EFBIG;
+		return -1;
+	}
+
+	if (z->count > 1)
+		qsort(z->entries, z->count, sizeof(*z->entries),
+		      compare_entries);
+
+	f = fopen(z->path, "wb");
+	if (!f)
+		return -1;
+	ret = write_entries(z, f);
+	if (fclose(f) != 0)
+		ret = -1;
+	return ret;
+}
+
+void zip_out_free(struct zip_out *z)
+{
+	int i;
+
+	if (!z)
+		return;
+
+	for (i = 0; i < z->count; i++) {
+		free(z->entries[i].name);
+		mem_free(z->entries[i].data);
+	}
+	free(z->entries);
+	pthread_mutex_destroy(&z->lock);
+	free(z->path);
+	free(z);
+}
@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - arena.c
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ *
+ * Blocks are chained and never given back before arena_free(). A reset
+ * rewinds to the first block; an allocation that does not fit moves on
+ * to the next block, and only allocates a new one at the end of the
+ * chain.
+ *
+ * The space handed out since the last reset is charged to @charged
+ * without allocating anything, so a line is held to the budget of its
+ * file even when the blocks are already there.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "types.h"
+#include "mem.h"
+
+#define ARENA_ALIGN	16
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+	/* data follows, aligned */
+};
+
+static size_t align_up(size_t n)
+{
+	return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static char *block_data(struct arena_block *b)
+{
+	return (char *)b + align_up(sizeof(*b));
+}
+
+void arena_init(struct arena *a)
+{
+	a->head = NULL;
+	a->cur = NULL;
+	a->account = mem_current();
+	a->charged = NULL;
+	a->used = 0;
+}
+
+static struct arena_block *block_new(struct arena *a, size_t size)
+{
+	struct mem_account *prev;
+	struct arena_block *b;
+
+	if (size < ARENA_BLOCK_SIZE)
+		size = ARENA_BLOCK_SIZE;
+
+	prev = mem_set_account(a->account);
+	b = mem_malloc(align_up(sizeof(*b)) + size);
+	mem_set_account(prev);
+	if (!b)
+		return NULL;
+
+	b->next = NULL;
+	b->size = size;
+	b->used = 0;
+	return b;
+}
+
+/* Credit back the space in use to the account it was charged to */
+static void uncharge(struct arena *a)
+{
+	mem_charge(a->charged, -(long long)a->used);
+	a->charged = NULL;
+	a->used = 0;
+}
+
+/*
+ * Charge @size more bytes in use to the account current when the
+ * first of them was allocated after the reset.
+ */
+static int charge_used(struct arena *a, size_t size)
+{
+	if (!a->used)
+		a->charged = mem_current();
+	if (mem_charge(a->charged, size) < 0)
+		return -1;
+	a->used += size;
+	return 0;
+}
+
+/*
+ * Return @size bytes aligned for any type, or NULL on failure.
+ */
+void *arena_alloc(struct arena *a, size_t size)
+{
+	struct arena_block *b;
+	void *p;
+
+	size = align_up(size);
+
+	if (!a->cur) {
+		if (!a->head) {
+			a->head = block_new(a, size);
+			if (!a->head)
+				return NULL;
+		}
+		a->cur = a->head;
+	}
+
+	b = a->cur;
+	while (b->size - b->used < size) {
+		if (!b->next) {
+			b->next = block_new(a, size);
+			if (!b->next)
+				return NULL;
+		}
+		b = b->next;
+	}
+
+	if (charge_used(a, size) < 0)
+		return NULL;
+	a->cur = b;
+	p = block_data(b) + b->used;
+	b->used += size;
+	return p;
+}
+
+char *arena_strndup(struct arena *a, const char *s, size_t len)
+{
+	char *p = arena_alloc(a, len + 1);
+
+	if (!p)
+		return NULL;
+	memcpy(p, s, len);
+	p[len] = '\0';
+	return p;
+}
+
+void arena_reset(struct arena *a)
+{
+	struct arena_block *b;
+
+	for (b = a->head; b; b = b->next)
+		b->used = 0;
+	a->cur = a->head;
+	uncharge(a);
+}
+
+void arena_free(struct arena *a)
+{
+	while (a->head) {
+		struct arena_block *b = a->head;
+
+		a->head = b->next;
+		mem_free(b);
+	}
+	a->cur = NULL;
+	uncharge(a);
+}
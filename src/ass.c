@@ -9,44 +9,114 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "ass.h"
+#include "archive.h"
+#include "srt.h"
 #include "types.h"
 #include "utils.h"
 #include "mecab_helpers.h"
+#include "utf8.h"
+#include "outbuf.h"
+#include "stats.h"
+#include "mem.h"
 
-static void write_ass_header(FILE *f, struct font_config *cfg)
+#define PUT_LITERAL(ob, s)	outbuf_put(ob, s, sizeof(s) - 1)
+
+static void write_ass_header(struct outbuf *ob, struct font_config *cfg)
 {
-	fprintf(f, "[Script Info]\n");
-	fprintf(f, "ScriptType: v4.00+\n");
-	fprintf(f, "PlayResX: %d\n", cfg->screen_w);
-	fprintf(f, "PlayResY: %d\n\n", cfg->screen_h);
+	PUT_LITERAL(ob, "[Script Info]\n");
+	PUT_LITERAL(ob, "ScriptType: v4.00+\n");
+	PUT_LITERAL(ob, "PlayResX: ");
+	outbuf_int(ob, cfg->screen_w);
+	PUT_LITERAL(ob, "\nPlayResY: ");
+	outbuf_int(ob, cfg->screen_h);
+	PUT_LITERAL(ob, "\n\n");
 }
 
-static void write_ass_styles(FILE *f, struct font_config *cfg)
+static void write_ass_styles(struct outbuf *ob, struct font_config *cfg)
 {
-	fprintf(f, "[V4+ Styles]\n");
-	fprintf(f, "Format: Name,Fontname,Fontsize,PrimaryColour,OutlineColour,"
-		   "BackColour,Bold,Italic,BorderStyle,Outline,Shadow,Alignment,"
-		   "MarginL,MarginR,MarginV,Effect,Encoding\n");
+	PUT_LITERAL(ob, "[V4+ Styles]\n");
+	PUT_LITERAL(ob, "Format: Name,Fontname,Fontsize,PrimaryColour,"
+		    "OutlineColour,BackColour,Bold,Italic,BorderStyle,Outline,"
+		    "Shadow,Alignment,MarginL,MarginR,MarginV,Effect,"
+		    "Encoding\n");
+
+	PUT_LITERAL(ob, "Style: Main,");
+	outbuf_puts(ob, cfg->font_name);
+	PUT_LITERAL(ob, ",");
+	outbuf_int(ob, cfg->main_size);
+	PUT_LITERAL(ob, ",&H00FFFFFF,&H00000000,&H00000000,"
+		    "0,0,1,2,0,5,10,10,10,\n");
 
-	fprintf(f, "Style: Main,%s,%d,&H00FFFFFF,&H00000000,&H00000000,"
-		   "0,0,1,2,0,5,10,10,10,\n",
-		cfg->font_name, cfg->main_size);
+	PUT_LITERAL(ob, "Style: Furi,");
+	outbuf_puts(ob, cfg->font_name);
+	PUT_LITERAL(ob, ",");
+	outbuf_int(ob, cfg->furigana_size);
+	PUT_LITERAL(ob, ",&H00FFFFFF,&H00000000,&H00000000,"
+		    "0,0,1,1,0,5,10,10,10,\n\n");
+}
 
-	fprintf(f, "Style: Furi,%s,%d,&H00FFFFFF,&H00000000,&H00000000,"
-		   "0,0,1,1,0,5,10,10,10,\n\n",
-		cfg->font_name, cfg->furigana_size);
+/*
+ * Cue times - "start,end," of a cue, formatted once for all its events
+ */
+struct cue_times {
+	char text[2 * MAX_TIME];
+	size_t len;
+};
+
+static void format_cue_times(const struct subtitle *sub, struct cue_times *t)
+{
+	size_t n;
+
+	n = format_ass_time(sub->start_ms, t->text);
+	t->text[n++] = ',';
+	n += format_ass_time(sub->end_ms, t->text + n);
+	t->text[n++] = ',';
+	t->len = n;
+}
+
+/*
+ * Start an event, as "Dialogue: @head<times>@style{\pos(x,y)\an5}",
+ * for its text to follow.
+ */
+static void start_event(struct outbuf *ob, const char *head,
+			const struct cue_times *t, const char *style, float x,
+			int y)
+{
+	PUT_LITERAL(ob, "Dialogue: ");
+	outbuf_puts(ob, head);
+	outbuf_put(ob, t->text, t->len);
+	outbuf_puts(ob, style);
+	PUT_LITERAL(ob, ",,0,0,0,,{\\pos(");
+	outbuf_fixed1(ob, x);
+	PUT_LITERAL(ob, ",");
+	outbuf_int(ob, y);
+	PUT_LITERAL(ob, ")\\an5}");
 }
 
-static int count_lines_in_text(const char *text)
+static void write_event(struct outbuf *ob, const char *head,
+			const struct cue_times *t, const char *style, float x,
+			int y, const char *text, size_t len)
 {
+	start_event(ob, head, t, style, x, y);
+	outbuf_put(ob, text, len);
+	PUT_LITERAL(ob, "\n");
+}
+
+static int count_lines_in_text(const struct subtitle *sub)
+{
+	const char *p = sub->text, *end = sub->text + sub->len;
 	int count = 1;
-	const char *p;
 
-	for (p = text; *p; p++) {
-		if (*p == '\n')
-			count++;
+	while ((p = memchr(p, '\n', end - p)) != NULL) {
+		count++;
+		p++;
 	}
 	return count;
 }
@@ -66,7 +136,7 @@ static int count_simultaneous_lines(struct subtitle *subs, int count,
 			if (subs[i].start_ms != subs[current].start_ms ||
 			    subs[i].end_ms != subs[current].end_ms)
 				break;
-			lines += count_lines_in_text(subs[i].text);
+			lines += count_lines_in_text(&subs[i]);
 		}
 	} else {
 		/* Count lines before current */
@@ -74,96 +144,592 @@ static int count_simultaneous_lines(struct subtitle *subs, int count,
 			if (subs[i].start_ms != subs[current].start_ms ||
 			    subs[i].end_ms != subs[current].end_ms)
 				break;
-			lines += count_lines_in_text(subs[i].text);
+			lines += count_lines_in_text(&subs[i]);
 		}
 	}
 	return lines;
 }
 
-static void write_subtitle_line(FILE *f, const char *ts, const char *te,
-				const char *line, int y,
-				struct font_config *cfg, mecab_t *mecab)
+/*
+ * Return the positioned furigana of @line, from the line cache when the
+ * same line was already analyzed with the same layout, and without
+ * running MeCab when the disk cache has its readings. The tokens are
+ * allocated from the arena of @an. Returns NULL if the line could not be
+ * analyzed, and then caches nothing.
+ */
+static struct furigana_token *analyze_line(const char *line,
+					   struct font_config *cfg,
+					   struct analyzer *an, int *tcount)
+{
+	struct furigana_token *tokens;
+
+	if (an->cache &&
+	    line_cache_get(an->cache, line, cfg, &an->arena, &tokens, tcount))
+		return tokens;
+
+	if (!an->disk || !disk_cache_get(an->disk, line, &an->arena, &tokens,
+					    tcount)) {
+		tokens = analyze_text_with_mecab(an, line, tcount);
+		if (!tokens)
+			return NULL;
+		if (an->disk)
+			disk_cache_put(an->disk, line, &an->arena, tokens,
+				       *tcount);
+	}
+
+	calculate_token_positions(line, tokens, *tcount, cfg);
+	if (an->cache)
+		line_cache_put(an->cache, line, cfg, tokens, *tcount);
+	return tokens;
+}
+
+static float reading_width(const struct furigana_token *tok,
+			   const struct font_config *cfg)
+{
+	return utf8_count(tok->reading, strlen(tok->reading)) *
+	       cfg->furigana_size;
+}
+
+/*
+ * Gap to leave before reading @t of the row, whose last reading ends at
+ * @cur. Gaps under half a pixel are not worth a spacer.
+ */
+static float reading_gap(const struct furigana_token *tokens, int t,
+			 float cur, const struct font_config *cfg)
+{
+	float gap = tokens[t].x - reading_width(&tokens[t], cfg) / 2 - cur;
+
+	return t > 0 && gap >= 0.5f ? gap : 0;
+}
+
+/*
+ * Write all the furigana of a line as one event, positioned like the
+ * per-reading events would be. Readings are laid out in a row, each
+ * after a hard space stretched with \fscx over the gap left since the
+ * previous one; kana are assumed to be furigana_size wide, and a hard
+ * space half that, as char_width assumes a fixed width for the line.
+ * Readings wider than the room they have push the next ones right.
+ */
+static void write_packed_furigana(struct outbuf *ob,
+				  const struct cue_times *ct,
+				  const struct furigana_token *tokens,
+				  int tcount, int y, struct font_config *cfg)
+{
+	float space = cfg->furigana_size / 2.0f;
+	float left, cur;
+	int t;
+
+	/* Lay the row out once to find its middle, where it is anchored */
+	left = tokens[0].x - reading_width(&tokens[0], cfg) / 2;
+	for (t = 0, cur = left; t < tcount; t++)
+		cur += reading_gap(tokens, t, cur, cfg) +
+		       reading_width(&tokens[t], cfg);
+
+	start_event(ob, "1,", ct, "Furi", (left + cur) / 2,
+		    y - cfg->furigana_offset);
+
+	for (t = 0, cur = left; t < tcount; t++) {
+		float gap = reading_gap(tokens, t, cur, cfg);
+
+		if (gap > 0) {
+			PUT_LITERAL(ob, "{\\fscx");
+			outbuf_int(ob, (int)(gap * 100 / space + 0.5f));
+			PUT_LITERAL(ob, "}\\h{\\fscx100}");
+		}
+		outbuf_puts(ob, tokens[t].reading);
+		cur += gap + reading_width(&tokens[t], cfg);
+	}
+	PUT_LITERAL(ob, "\n");
+}
+
+/*
+ * Write the events of the @len bytes at @text. Lines without kanji get
+ * no furigana, so they are not copied or tagged. The arena of @an is
+ * reset first, so nothing allocated for the previous line survives.
+ * A line that cannot be analyzed fails @ob, rather than being written
+ * without its furigana.
+ */
+static void write_subtitle_line(struct outbuf *ob, const struct cue_times *ct,
+				const char *text, size_t len, int y,
+				struct font_config *cfg, struct analyzer *an)
 {
 	struct furigana_token *tokens;
+	char *line;
 	int tcount = 0;
 	int t;
 
-	fprintf(f, "Dialogue: 0,%s,%s,Main,,0,0,0,,{\\pos(%.1f,%d)\\an5}%s\n",
-		ts, te, cfg->screen_w / 2.0f, y, line);
+	write_event(ob, "0,", ct, "Main", cfg->screen_w / 2.0f, y, text, len);
 
-	tokens = analyze_text_with_mecab(mecab, line, &tcount);
-	if (tokens)
-		calculate_token_positions(line, tokens, tcount, cfg);
+	if (!an || !utf8_has_kanji(text, len))
+		return;
+
+	arena_reset(&an->arena);
+	line = arena_strndup(&an->arena, text, len);
+	tokens = line ? analyze_line(line, cfg, an, &tcount) : NULL;
+	if (!tokens) {
+		ob->failed = 1;
+		return;
+	}
+	if (an->stats)
+		an->stats->tokens += tcount;
+
+	if (cfg->packed_furigana && tcount > 0) {
+		write_packed_furigana(ob, ct, tokens, tcount, y, cfg);
+		return;
+	}
 
 	for (t = 0; t < tcount; t++) {
-		fprintf(f, "Dialogue: 1,%s,%s,Furi,,0,0,0,,"
-			   "{\\pos(%.1f,%d)\\an5}%s\n",
-			ts, te, tokens[t].x, y - cfg->furigana_offset,
-			tokens[t].reading);
-		free(tokens[t].reading);
+		write_event(ob, "1,", ct, "Furi", tokens[t].x,
+			    y - cfg->furigana_offset, tokens[t].reading,
+			    strlen(tokens[t].reading));
 	}
-	free(tokens);
 }
 
-static void process_subtitle(FILE *f, struct subtitle *subs, int count,
-			     int idx, struct font_config *cfg, mecab_t *mecab)
+/*
+ * Write the events of cue @idx. Without an analyzer, only the subtitle
+ * lines are written, as for a file that has no kanji at all.
+ */
+static void process_subtitle(struct outbuf *ob, struct subtitle *subs,
+			     int count, int idx, struct font_config *cfg,
+			     struct analyzer *an)
 {
-	char ts[MAX_TIME], te[MAX_TIME];
-	char *copy, *line, *save;
+	struct cue_times ct;
+	const char *text, *end;
 	int num_lines, lines_after, line_idx;
 	int line_from_bottom, y;
 
-	format_ass_time(subs[idx].start_ms, ts);
-	format_ass_time(subs[idx].end_ms, te);
+	format_cue_times(&subs[idx], &ct);
 
-	num_lines = count_lines_in_text(subs[idx].text);
+	num_lines = count_lines_in_text(&subs[idx]);
 	lines_after = count_simultaneous_lines(subs, count, idx, 1);
 
-	copy = strdup(subs[idx].text);
-	if (!copy)
-		return;
-
-	save = NULL;
 	line_idx = 0;
-	line = strtok_r(copy, "\n", &save);
 
-	while (line) {
+	end = subs[idx].text + subs[idx].len;
+
+	for (text = subs[idx].text; text < end; ) {
+		const char *nl = memchr(text, '\n', end - text);
+		size_t len = (nl ? nl : end) - text;
+
+		if (len == 0) {
+			text++;
+			continue;
+		}
+
 		line_from_bottom = lines_after + (num_lines - 1 - line_idx);
 		y = cfg->baseline_y - line_from_bottom * cfg->line_spacing;
 
-		write_subtitle_line(f, ts, te, line, y, cfg, mecab);
-
-		line = strtok_r(NULL, "\n", &save);
+		write_subtitle_line(ob, &ct, text, len, y, cfg, an);
+		text += len;
 		line_idx++;
 	}
+}
+
+int ass_doc_init(struct ass_doc *doc, struct subtitle *subs, int count,
+		 struct font_config *cfg)
+{
+	int i;
+
+	doc->subs = subs;
+	doc->count = count;
+	doc->cfg = cfg;
+	doc->nchunks = (count + ASS_CHUNK_CUES - 1) / ASS_CHUNK_CUES;
+	doc->chunks = NULL;
+	doc->written = 0;
+
+	if (doc->nchunks == 0)
+		return 0;
+
+	doc->chunks = mem_calloc(doc->nchunks, sizeof(struct ass_chunk));
+	if (!doc->chunks)
+		return -1;
+
+	for (i = 0; i < doc->nchunks; i++) {
+		doc->chunks[i].first = i * ASS_CHUNK_CUES;
+		doc->chunks[i].last = doc->chunks[i].first + ASS_CHUNK_CUES;
+		if (doc->chunks[i].last > count)
+			doc->chunks[i].last = count;
+	}
+	return 0;
+}
+
+/*
+ * Check whether any cue of @doc has kanji, i.e. whether it needs to be
+ * analyzed at all.
+ */
+int ass_doc_has_kanji(const struct ass_doc *doc)
+{
+	int i;
 
-	free(copy);
+	for (i = 0; i < doc->count; i++) {
+		if (utf8_has_kanji(doc->subs[i].text, doc->subs[i].len))
+			return 1;
+	}
+	return 0;
 }
 
-void generate_ass(const char *input, struct subtitle *subs, int count,
-		  struct font_config *cfg, mecab_t *mecab)
+void ass_doc_free(struct ass_doc *doc)
 {
-	FILE *f;
-	char out[JPSUB_MAX_PATH];
 	int i;
 
-	snprintf(out, sizeof(out), "%s.ass", input);
+	for (i = 0; i < doc->nchunks; i++)
+		mem_free(doc->chunks[i].buf);
+	mem_free(doc->chunks);
+	doc->chunks = NULL;
+	doc->nchunks = 0;
+}
 
-	f = fopen(out, "w");
-	if (!f) {
-		perror("fopen");
-		return;
+/*
+ * Render the events of chunk @idx to memory. Distinct chunks of a
+ * document may be rendered concurrently, each with its own analyzer.
+ * A document without kanji (see ass_doc_has_kanji()) needs none, and
+ * @an may then be NULL. With stats, the time not spent in MeCab counts
+ * as layout.
+ */
+int ass_render_chunk(struct ass_doc *doc, int idx, struct analyzer *an)
+{
+	struct ass_chunk *c = &doc->chunks[idx];
+	struct conv_stats *st = an ? an->stats : NULL;
+	double start = 0.0, analysis = 0.0;
+	struct outbuf ob;
+	int i;
+
+	if (st) {
+		start = monotonic_seconds();
+		analysis = st->seconds[STATS_MECAB] +
+			   st->seconds[STATS_READINGS];
+	}
+
+	outbuf_init(&ob);
+	for (i = c->first; i < c->last; i++)
+		process_subtitle(&ob, doc->subs, doc->count, i, doc->cfg, an);
+	/* The last line is no longer charged to this file */
+	if (an)
+		arena_reset(&an->arena);
+
+	if (st) {
+		analysis = st->seconds[STATS_MECAB] +
+			   st->seconds[STATS_READINGS] - analysis;
+		st->seconds[STATS_LAYOUT] += monotonic_seconds() - start -
+					     analysis;
+	}
+
+	if (ob.failed) {
+		outbuf_free(&ob);
+		return -1;
+	}
+	c->buf = outbuf_release(&ob, &c->len);
+	return 0;
+}
+
+static void write_ass_preamble(struct outbuf *ob, struct font_config *cfg)
+{
+	write_ass_header(ob, cfg);
+	write_ass_styles(ob, cfg);
+
+	PUT_LITERAL(ob, "[Events]\n");
+	PUT_LITERAL(ob, "Format: Layer,Start,End,Style,Name,MarginL,MarginR,"
+		    "MarginV,Effect,Text\n");
+}
+
+static int stream_equals(FILE *f, const char *buf, size_t len)
+{
+	char tmp[8192];
+
+	while (len > 0) {
+		size_t n = len < sizeof(tmp) ? len : sizeof(tmp);
+
+		if (fread(tmp, 1, n, f) != n || memcmp(tmp, buf, n) != 0)
+			return 0;
+		buf += n;
+		len -= n;
 	}
+	return 1;
+}
 
-	write_ass_header(f, cfg);
-	write_ass_styles(f, cfg);
+/* Size of the output: the preamble @head, then the events of @doc */
+static size_t doc_size(const struct ass_doc *doc, const struct outbuf *head)
+{
+	size_t total = head->len;
+	int i;
 
-	fprintf(f, "[Events]\n");
-	fprintf(f, "Format: Layer,Start,End,Style,Name,MarginL,MarginR,"
-		   "MarginV,Effect,Text\n");
+	for (i = 0; i < doc->nchunks; i++)
+		total += doc->chunks[i].len;
+	return total;
+}
 
-	for (i = 0; i < count; i++)
-		process_subtitle(f, subs, count, i, cfg, mecab);
+/*
+ * Check whether the file at @out already holds exactly the preamble
+ * @head followed by the events of @doc.
+ */
+static int ass_doc_unchanged(struct ass_doc *doc, const char *out,
+			     const struct outbuf *head)
+{
+	size_t total = doc_size(doc, head);
+	struct stat st;
+	FILE *f;
+	int same;
+	int i;
 
+	if (stat(out, &st) < 0 || st.st_size != (off_t)total)
+		return 0;
+
+	f = fopen(out, "rb");
+	if (!f)
+		return 0;
+
+	same = stream_equals(f, head->data, head->len);
+	for (i = 0; same && i < doc->nchunks; i++)
+		same = stream_equals(f, doc->chunks[i].buf,
+				     doc->chunks[i].len);
 	fclose(f);
+	return same;
+}
+
+/*
+ * Write the @n buffers of @iov to @fd, ASS_IOV_BATCH at a time, until
+ * all of them are written.
+ */
+static int write_iov(int fd, struct iovec *iov, int n)
+{
+	while (n > 0) {
+		ssize_t w = writev(fd, iov, n < ASS_IOV_BATCH ? n :
+						ASS_IOV_BATCH);
+
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		while (n > 0 && (size_t)w >= iov->iov_len) {
+			w -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n > 0) {
+			iov->iov_base = (char *)iov->iov_base + w;
+			iov->iov_len -= w;
+		}
+	}
+	return 0;
+}
+
+/*
+ * The buffers of a document whose chunks are all rendered: the
+ * preamble @head, then the events of each chunk.
+ */
+static struct iovec *doc_iov(struct ass_doc *doc, struct outbuf *head)
+{
+	struct iovec *iov;
+	int i;
+
+	iov = mem_malloc((doc->nchunks + 1) * sizeof(struct iovec));
+	if (!iov) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	iov[0].iov_base = head->data;
+	iov[0].iov_len = head->len;
+	for (i = 0; i < doc->nchunks; i++) {
+		iov[i + 1].iov_base = doc->chunks[i].buf;
+		iov[i + 1].iov_len = doc->chunks[i].len;
+	}
+	return iov;
+}
+
+/*
+ * Write @out from a document whose chunks are all rendered, with a few
+ * large writes straight from the chunk buffers. With @keep_identical,
+ * an existing file with the same content is left alone so its mtime is
+ * preserved.
+ * Returns 1 if the file was left alone, 0 if written, -1 on failure.
+ */
+int ass_doc_write(struct ass_doc *doc, const char *out, int keep_identical)
+{
+	struct outbuf head;
+	struct iovec *iov;
+	int fd, ret = -1;
+
+	outbuf_init(&head);
+	write_ass_preamble(&head, doc->cfg);
+	if (head.failed) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (keep_identical && ass_doc_unchanged(doc, out, &head)) {
+		outbuf_free(&head);
+		return 1;
+	}
+
+	iov = doc_iov(doc, &head);
+	if (!iov) {
+		outbuf_free(&head);
+		return -1;
+	}
+
+	fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd >= 0) {
+		ret = write_iov(fd, iov, doc->nchunks + 1);
+		if (close(fd) < 0)
+			ret = -1;
+	}
+	if (ret == 0)
+		doc->written = doc_size(doc, &head);
+
+	mem_free(iov);
+	outbuf_free(&head);
+	return ret;
+}
+
+/*
+ * Add a document whose chunks are all rendered to the output zip @z, as
+ * entry @name.
+ */
+int ass_doc_write_zip(struct ass_doc *doc, struct zip_out *z,
+		      const char *name)
+{
+	struct outbuf head;
+	struct iovec *iov;
+	int ret = -1;
+
+	outbuf_init(&head);
+	write_ass_preamble(&head, doc->cfg);
+	if (head.failed) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	iov = doc_iov(doc, &head);
+	if (iov) {
+		ret = zip_out_add(z, name, iov, doc->nchunks + 1);
+		mem_free(iov);
+	}
+	if (ret == 0)
+		doc->written = doc_size(doc, &head);
+	outbuf_free(&head);
+	return ret;
+}
+
+/*
+ * Cue window - the cues read from a stream but not written yet. Cues
+ * are held until one with another timing arrives, since the lines of
+ * the simultaneous cues after a cue decide where it is stacked.
+ */
+struct cue_window {
+	struct subtitle *subs;
+	struct cue_text {
+		char *buf;
+		size_t cap;
+	} *text;
+	int count;
+	int capacity;
+};
+
+static int cue_window_grow(struct cue_window *w)
+{
+	int capacity = w->capacity ? w->capacity * 2 : ASS_STREAM_WINDOW;
+	struct subtitle *subs;
+	struct cue_text *text;
+
+	subs = realloc(w->subs, capacity * sizeof(struct subtitle));
+	if (!subs)
+		return -1;
+	w->subs = subs;
+
+	text = realloc(w->text, capacity * sizeof(struct cue_text));
+	if (!text)
+		return -1;
+	memset(text + w->capacity, 0,
+	       (capacity - w->capacity) * sizeof(struct cue_text));
+	w->text = text;
+	w->capacity = capacity;
+	return 0;
+}
+
+/*
+ * Write the cues held in @w, then make the cue read after them, which
+ * has another timing, the first of the window.
+ */
+static void cue_window_flush(struct outbuf *ob, struct cue_window *w,
+			     struct font_config *cfg, struct analyzer *an)
+{
+	struct cue_text tmp;
+	int n = w->count;
+	int i;
+
+	for (i = 0; i < n; i++)
+		process_subtitle(ob, w->subs, n, i, cfg, an);
+
+	tmp = w->text[0];
+	w->text[0] = w->text[n];
+	w->text[n] = tmp;
+	w->subs[0] = w->subs[n];
+	w->count = 0;
+}
+
+/*
+ * Convert the cues of @in to ASS on @out as they arrive. Only the cues
+ * that share the timing of the last one are held, so memory does not
+ * grow with the length of the input. The output is the same as a batch
+ * conversion would write for the whole file.
+ */
+int ass_stream(struct srt_stream *in, FILE *out, struct font_config *cfg,
+	       struct analyzer *an)
+{
+	struct cue_window w = {0};
+	struct outbuf ob;
+	int ret = 0;
+	int i;
+
+	outbuf_init(&ob);
+	write_ass_preamble(&ob, cfg);
+
+	for (;;) {
+		struct subtitle *sub;
+		struct cue_text *t;
+		int r;
+
+		if (w.count == w.capacity && cue_window_grow(&w) < 0) {
+			errno = ENOMEM;
+			ret = -1;
+			break;
+		}
+
+		sub = &w.subs[w.count];
+		t = &w.text[w.count];
+		r = srt_stream_next(in, sub, &t->buf, &t->cap);
+		if (r <= 0) {
+			ret = r;
+			break;
+		}
+
+		if (w.count > 0 && (sub->start_ms != w.subs[0].start_ms ||
+				    sub->end_ms != w.subs[0].end_ms)) {
+			cue_window_flush(&ob, &w, cfg, an);
+			if (ob.len >= OUTBUF_FLUSH_SIZE &&
+			    outbuf_flush(&ob, out) < 0) {
+				ret = -1;
+				break;
+			}
+		}
+		w.count++;
+	}
+
+	for (i = 0; i < w.count; i++)
+		process_subtitle(&ob, w.subs, w.count, i, cfg, an);
+	if (outbuf_flush(&ob, out) < 0)
+		ret = -1;
+	outbuf_free(&ob);
+
+	for (i = 0; i < w.capacity; i++)
+		free(w.text[i].buf);
+	free(w.text);
+	free(w.subs);
+
+	if (fflush(out) != 0 || ferror(out))
+		ret = -1;
+	return ret;
 }
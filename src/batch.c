@@ -0,0 +1,1520 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - batch.c
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ *
+ * Converts a set of files as a pipeline of stages connected by bounded
+ * queues:
+ *
+ *   walk -> parse -> analyze -> write
+ *
+ * The walker expands directories and stats every input up front, then
+ * dispatches them largest first. Parsers read the .srt files, analyzers
+ * run MeCab over chunks of cues and writers produce the .ass files.
+ *
+ * An analyzer renders the chunks of the file it took from the front;
+ * analyzers that run out of files steal chunks from the back of the file
+ * with the most work left, so a single large file does not leave the
+ * other cores idle at the end of a run.
+ *
+ * Results are reported in discovery order, so the console output does
+ * not depend on the number of threads in each stage.
+ *
+ * In incremental mode, parsers skip inputs whose manifest entry shows
+ * the output was made from the same source with the same settings, and
+ * writers leave outputs alone when their content would not change.
+ *
+ * Archives are expanded by the walker like folders: each of their SRT
+ * members is a job of its own, read from the archive by a parser. The
+ * outputs go next to the archive, or into a zip of their own that is
+ * written once the pipeline is done. Members of a compressed tar are
+ * kept from the walk up to ARCHIVE_HELD_BYTES in all, since nothing is
+ * parsed before the walk ends; the others are decompressed again from
+ * the start of their archive by the parser.
+ *
+ * With --stats, each stage adds its time and counters to the job, and
+ * they are reported with it. With allocation accounting, what a stage
+ * allocates for a job is charged to an account of the job for that
+ * stage; a job that goes over the memory budget fails on its own.
+ *
+ * Standard input is not a file of the batch: batch_stream() converts it
+ * to standard output cue by cue, without the pipeline.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <mecab.h>
+
+#include "batch.h"
+#include "archive.h"
+#include "utils.h"
+#include "mecab_helpers.h"
+#include "queue.h"
+#include "srt.h"
+#include "mkv.h"
+#include "ass.h"
+#include "line_cache.h"
+#include "disk_cache.h"
+#include "manifest.h"
+#include "walk.h"
+#include "stats.h"
+#include "mem.h"
+
+enum stage_id {
+	STAGE_WALK,
+	STAGE_PARSE,
+	STAGE_ANALYZE,
+	STAGE_WRITE,
+	NR_STAGES
+};
+
+static const char *const stage_names[NR_STAGES] = {
+	"walk", "parse", "analyze", "write"
+};
+
+enum job_state {
+	JOB_CONVERTED,
+	JOB_UP_TO_DATE,		/* skipped, manifest entry still valid */
+	JOB_UNCHANGED,		/* converted, existing output kept */
+};
+
+/*
+ * Batch job - a single input file travelling through the stages
+ */
+struct batch_job {
+	char *path;
+	char *out;		/* path of the .ass file */
+	off_t size;
+	int root;		/* command-line argument it was found under */
+	int seq;		/* discovery order */
+	char *archive;		/* archive holding the input, or NULL */
+	struct archive_member member;
+	struct zip_out *zip;	/* output archive, or NULL */
+	struct srt_file srt;
+	struct ass_doc doc;
+	int next_chunk;		/* unclaimed: [next_chunk, end_chunk) */
+	int end_chunk;
+	int pending;		/* chunks not rendered yet */
+	int count;		/* subtitles converted, -1 on failure */
+	int err;		/* errno of the failure */
+	int done;
+	enum job_state state;
+	struct manifest_entry entry;	/* path is NULL if not recorded */
+	struct conv_stats stats;
+	struct mem_account mem[NR_STAGES];	/* charged to @mem_file */
+	struct mem_account mem_file;
+	struct batch_job *next;
+	struct batch_job *active_next;
+};
+
+struct stage {
+	int nthreads;
+	int started;
+	struct queue *in;
+	double busy;		/* seconds spent working, all threads */
+};
+
+struct pipeline {
+	struct batch *b;
+	struct font_config *cfg;
+	struct manifest *manifest;	/* NULL unless incremental */
+	uint64_t cfg_hash;
+	struct queue parse_q;
+	struct queue analyze_q;
+	struct queue write_q;
+	struct stage stages[NR_STAGES];
+
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	struct batch_job *head;
+	struct batch_job **tail;
+	int nfiles;
+	int walkers;		/* threads reading directories */
+	int root;		/* argument being walked */
+	struct walk_stats walk;
+	int walk_done;
+	int zip_output;		/* archive outputs go to a zip */
+	size_t held;		/* member bytes kept from the walk */
+	struct zip_out **zips;
+	int nzips;
+	int zips_cap;
+	struct batch_job *active;	/* jobs with unclaimed chunks */
+	int stolen;
+	int plain;		/* files without kanji, never analyzed */
+	int stats;		/* collect stage timers and counters */
+	int print_stats;
+	FILE *stats_json;	/* JSON lines of the stats, or NULL */
+	struct conv_stats total;
+	int print_mem;
+	long long mem_budget;
+	struct mem_account mem_run;	/* every file, at once */
+	struct mem_account mem_analyzers;	/* kept for the whole run */
+	struct mem_account mem_total[NR_STAGES];
+	const struct batch_job *mem_largest;	/* highest file peak */
+	double start;
+	double last_done;
+};
+
+struct stage_thread {
+	pthread_t thread;
+	struct pipeline *p;
+	enum stage_id stage;
+	struct analyzer *an;
+	struct batch_job *own;	/* job whose chunks this analyzer claims */
+	struct conv_stats stats;	/* of the chunk being rendered */
+	double busy;
+	double finished;
+};
+
+/*
+ * Record a root file or directory. Directories are expanded by the
+ * walker stage once the batch runs.
+ * Returns 1 if the path was queued, 0 if it is not a subtitle input and -1
+ * if it cannot be accessed.
+ */
+int batch_add_path(struct batch *b, const char *path)
+{
+	struct stat st;
+	char **tmp;
+
+	if (stat(path, &st) != 0)
+		return -1;
+
+	if (!S_ISDIR(st.st_mode) && !is_subtitle_input(path))
+		return 0;
+
+	if (b->count >= b->capacity) {
+		int capacity = b->capacity ? b->capacity * 2 : 16;
+
+		tmp = realloc(b->roots, capacity * sizeof(char *));
+		if (!tmp)
+			return -1;
+		b->roots = tmp;
+		b->capacity = capacity;
+	}
+
+	b->roots[b->count] = strdup(path);
+	if (!b->roots[b->count])
+		return -1;
+
+	b->count++;
+	return 1;
+}
+
+void batch_free(struct batch *b)
+{
+	int i;
+
+	for (i = 0; i < b->count; i++)
+		free(b->roots[i]);
+	free(b->roots);
+	b->roots = NULL;
+	b->count = 0;
+	b->capacity = 0;
+}
+
+static int default_worker_count(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (int)n : 1;
+}
+
+void batch_default_opts(struct batch_opts *opts)
+{
+	opts->walkers = WALK_THREADS;
+	opts->parsers = 2;
+	opts->analyzers = default_worker_count();
+	opts->writers = 1;
+	opts->cache_lines = LINE_CACHE_ENTRIES;
+	opts->disk_cache = NULL;
+	opts->manifest = NULL;
+	opts->reading_field = MECAB_READING_FIELD;
+	opts->zip_output = 0;
+	opts->report = 0;
+	opts->stats = 0;
+	opts->stats_json = NULL;
+	opts->mem_stats = 0;
+	opts->mem_budget = 0;
+}
+
+static void finish_job(struct pipeline *p, struct batch_job *job, int count,
+		       int err)
+{
+	pthread_mutex_lock(&p->lock);
+	job->count = count;
+	job->err = count < 0 ? (err ? err : EIO) : 0;
+	job->done = 1;
+	p->last_done = monotonic_seconds();
+	pthread_cond_broadcast(&p->changed);
+	pthread_mutex_unlock(&p->lock);
+}
+
+static void release_job_data(struct batch_job *job)
+{
+	ass_doc_free(&job->doc);
+	srt_close(&job->srt);
+}
+
+/*
+ * Output path of @path: its .srt or .mkv extension replaced by .ass,
+ * after the first @dir_len bytes of @dir.
+ */
+static char *output_path(const char *dir, size_t dir_len, const char *path)
+{
+	size_t len = strlen(path);
+	char *out;
+
+	if (ends_with_srt(path) || ends_with_mkv(path))
+		len -= 4;
+
+	out = malloc(dir_len + len + sizeof(".ass"));
+	if (!out)
+		return NULL;
+	memcpy(out, dir, dir_len);
+	memcpy(out + dir_len, path, len);
+	strcpy(out + dir_len + len, ".ass");
+	return out;
+}
+
+/*
+ * Job for the input at @path, taking over @path and @out.
+ */
+static struct batch_job *new_job(char *path, char *out, off_t size)
+{
+	struct batch_job *job = NULL;
+
+	if (path && out)
+		job = calloc(1, sizeof(struct batch_job));
+	if (!job) {
+		free(path);
+		free(out);
+		return NULL;
+	}
+
+	job->path = path;
+	job->out = out;
+	job->size = size;
+	return job;
+}
+
+static void add_job(struct pipeline *p, struct batch_job *job)
+{
+	int s;
+
+	for (s = 0; s < NR_STAGES; s++)
+		job->mem[s].parent = &job->mem_file;
+	job->mem_file.parent = &p->mem_run;
+	job->mem_file.budget = p->mem_budget;
+
+	pthread_mutex_lock(&p->lock);
+	job->root = p->root;
+	job->seq = p->nfiles++;
+	*p->tail = job;
+	p->tail = &job->next;
+	pthread_mutex_unlock(&p->lock);
+}
+
+/*
+ * Archive walk - an archive being listed, with the zip its outputs go
+ * to if they are not written next to it
+ */
+struct archive_walk {
+	struct pipeline *p;
+	const char *path;
+	size_t dir_len;		/* of its folder, slash included */
+	time_t mtime;
+	struct zip_out *zip;
+};
+
+/*
+ * Output zip of the archive at @path: its extension replaced by .ass.zip.
+ */
+static struct zip_out *new_zip_output(struct pipeline *p, const char *path,
+				      time_t mtime)
+{
+	struct zip_out *z, **tmp;
+	size_t len = strlen(path);
+	char *out;
+
+	len -= len > 7 && strcmp(path + len - 7, ".tar.gz") == 0 ? 7 : 4;
+	out = malloc(len + sizeof(".ass.zip"));
+	if (!out)
+		return NULL;
+	memcpy(out, path, len);
+	strcpy(out + len, ".ass.zip");
+
+	z = zip_out_new(out, mtime);
+	free(out);
+	if (!z)
+		return NULL;
+
+	pthread_mutex_lock(&p->lock);
+	if (p->nzips >= p->zips_cap) {
+		int capacity = p->zips_cap ? p->zips_cap * 2 : 4;
+
+		tmp = realloc(p->zips, capacity * sizeof(*tmp));
+		if (!tmp) {
+			pthread_mutex_unlock(&p->lock);
+			zip_out_free(z);
+			return NULL;
+		}
+		p->zips = tmp;
+		p->zips_cap = capacity;
+	}
+	p->zips[p->nzips++] = z;
+	pthread_mutex_unlock(&p->lock);
+	return z;
+}
+
+static int compare_zips(const void *a, const void *b)
+{
+	return strcmp(zip_out_path(*(struct zip_out *const *)a),
+		      zip_out_path(*(struct zip_out *const *)b));
+}
+
+/*
+ * Keep the contents of @m, a member of the compressed tar being walked,
+ * for @job if they fit in what is left of ARCHIVE_HELD_BYTES. They are
+ * charged to the job, so they count towards its budget.
+ */
+static void hold_member(struct pipeline *p, struct batch_job *job,
+			struct archive_member *m)
+{
+	struct mem_account *prev;
+	int fits;
+
+	pthread_mutex_lock(&p->lock);
+	fits = m->usize <= ARCHIVE_HELD_BYTES - p->held;
+	if (fits)
+		p->held += m->usize;
+	pthread_mutex_unlock(&p->lock);
+	if (!fits)
+		return;
+
+	prev = mem_set_account(&job->mem[STAGE_PARSE]);
+	if (archive_load(m) == 0) {
+		job->member.data = m->data;
+		m->data = NULL;
+	} else {
+		pthread_mutex_lock(&p->lock);
+		p->held -= m->usize;
+		pthread_mutex_unlock(&p->lock);
+	}
+	mem_set_account(prev);
+}
+
+static int walk_member(struct archive_member *m, void *data)
+{
+	struct archive_walk *aw = data;
+	struct batch_job *job;
+	size_t len = strlen(aw->path);
+	char *path, *out;
+
+	if (aw->p->zip_output && !aw->zip) {
+		aw->zip = new_zip_output(aw->p, aw->path, aw->mtime);
+		if (!aw->zip)
+			return -1;
+	}
+
+	path = malloc(len + strlen(m->name) + 2);
+	if (path)
+		sprintf(path, "%s/%s", aw->path, m->name);
+	if (aw->zip)
+		out = output_path("", 0, m->name);
+	else
+		out = output_path(aw->path, aw->dir_len, m->name);
+
+	job = new_job(path, out, m->usize);
+	if (job)
+		job->archive = strdup(aw->path);
+	if (!job || !job->archive) {
+		if (job) {
+			free(job->path);
+			free(job->out);
+			free(job);
+		}
+		return -1;
+	}
+
+	job->member = *m;
+	job->member.name = NULL;
+	job->member.stream = NULL;
+	job->zip = aw->zip;
+	add_job(aw->p, job);
+
+	if (m->method == MEMBER_TAR_GZ)
+		hold_member(aw->p, job, m);
+	return 0;
+}
+
+/*
+ * Queue a job for every SRT member of an archive. An archive that
+ * cannot be listed gets a job of its own that fails.
+ */
+static int walk_archive(struct pipeline *p, const char *path,
+			const struct stat *st)
+{
+	const char *slash = strrchr(path, '/');
+	struct archive_walk aw;
+	struct batch_job *job;
+
+	memset(&aw, 0, sizeof(aw));
+	aw.p = p;
+	aw.path = path;
+	aw.dir_len = slash ? (size_t)(slash - path) + 1 : 0;
+	aw.mtime = st->st_mtime;
+
+	if (archive_list(path, walk_member, &aw) == 0)
+		return 0;
+
+	job = new_job(strdup(path), strdup(path), st->st_size);
+	if (!job)
+		return -1;
+	job->err = errno ? errno : EINVAL;
+	add_job(p, job);
+	return 0;
+}
+
+static int walk_file(const char *path, const struct stat *st, void *data)
+{
+	struct pipeline *p = data;
+	struct batch_job *job;
+
+	if (is_archive(path))
+		return walk_archive(p, path, st);
+
+	job = new_job(strdup(path), output_path("", 0, path), st->st_size);
+	if (!job)
+		return -1;
+
+	/* Only files with a real path can be found again next time */
+	if (p->manifest) {
+		job->entry.path = realpath(path, NULL);
+		strcpy(job->entry.version, JPSUB_VERSION);
+		job->entry.cfg_hash = p->cfg_hash;
+		job->entry.size = st->st_size;
+		job->entry.mtime = st->st_mtim;
+	}
+
+	add_job(p, job);
+	return 0;
+}
+
+/*
+ * Walker threads find files in no particular order; sort them by
+ * argument, then by path, so the console output does not depend on
+ * the walk.
+ */
+static int compare_discovery(const void *a, const void *b)
+{
+	const struct batch_job *ja = *(const struct batch_job *const *)a;
+	const struct batch_job *jb = *(const struct batch_job *const *)b;
+
+	if (ja->root != jb->root)
+		return ja->root - jb->root;
+	return strcmp(ja->path, jb->path);
+}
+
+static int compare_largest_first(const void *a, const void *b)
+{
+	const struct batch_job *ja = *(const struct batch_job *const *)a;
+	const struct batch_job *jb = *(const struct batch_job *const *)b;
+
+	if (ja->size != jb->size)
+		return ja->size < jb->size ? 1 : -1;
+	return ja->seq - jb->seq;
+}
+
+/*
+ * Collect and stat every input, then hand them to the parsers largest
+ * first so the biggest files do not start last and set the makespan.
+ */
+static void walk_stage(struct stage_thread *t)
+{
+	struct pipeline *p = t->p;
+	double start = monotonic_seconds();
+	struct batch_job **order, *job;
+	int i;
+
+	for (i = 0; i < p->b->count; i++) {
+		const char *root = p->b->roots[i];
+		struct stat st;
+
+		if (stat(root, &st) != 0)
+			memset(&st, 0, sizeof(st));
+
+		p->root = i;
+		if (S_ISDIR(st.st_mode))
+			walk_tree(root, p->walkers, walk_file, p, &p->walk);
+		else
+			walk_file(root, &st, p);
+	}
+
+	order = malloc((p->nfiles ? p->nfiles : 1) * sizeof(*order));
+	for (i = 0, job = p->head; order && job; job = job->next)
+		order[i++] = job;
+
+	pthread_mutex_lock(&p->lock);
+	if (order) {
+		qsort(order, p->nfiles, sizeof(*order), compare_discovery);
+		p->tail = &p->head;
+		for (i = 0; i < p->nfiles; i++) {
+			order[i]->seq = i;
+			*p->tail = order[i];
+			p->tail = &order[i]->next;
+		}
+		*p->tail = NULL;
+		qsort(order, p->nfiles, sizeof(*order), compare_largest_first);
+	}
+
+	t->busy += monotonic_seconds() - start;
+
+	p->walk_done = 1;
+	pthread_cond_broadcast(&p->changed);
+	pthread_mutex_unlock(&p->lock);
+
+	/* Without memory to sort, fall back to discovery order */
+	for (i = 0, job = p->head; job; job = job->next, i++)
+		queue_push(&p->parse_q, order ? order[i] : job);
+
+	free(order);
+}
+
+static int same_time(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+/*
+ * Check the manifest entry of @job: the output must be the one this
+ * version made with the current settings, and the source must have the
+ * same size and mtime or, failing that, the same content. Fills in the
+ * source hash for the new entry either way.
+ */
+static int job_up_to_date(struct pipeline *p, struct batch_job *job)
+{
+	const struct manifest_entry *e;
+	struct stat st;
+	int valid;
+
+	e = manifest_find(p->manifest, job->entry.path);
+
+	valid = e && strcmp(e->version, JPSUB_VERSION) == 0 &&
+		e->cfg_hash == p->cfg_hash && stat(job->out, &st) == 0 &&
+		st.st_size == e->out_size && same_time(&st.st_mtim,
+						       &e->out_mtime);
+
+	if (valid && e->size == job->entry.size &&
+	    same_time(&e->mtime, &job->entry.mtime)) {
+		job->entry.src_hash = e->src_hash;
+	} else if (hash_file(job->path, &job->entry.src_hash) < 0 ||
+		   !valid || e->src_hash != job->entry.src_hash) {
+		return 0;
+	}
+
+	job->entry.count = e->count;
+	job->entry.out_size = e->out_size;
+	job->entry.out_mtime = e->out_mtime;
+	return 1;
+}
+
+/*
+ * Read the cues of an SRT file, of the SRT track of a Matroska file or
+ * of an SRT member of an archive.
+ */
+static int open_input(struct pipeline *p, struct batch_job *job)
+{
+	size_t len;
+	char *buf;
+
+	if (job->archive) {
+		/* Kept from the walk, now in flight like any input */
+		if (job->member.data) {
+			pthread_mutex_lock(&p->lock);
+			p->held -= job->member.usize;
+			pthread_mutex_unlock(&p->lock);
+		}
+		if (archive_read(job->archive, &job->member, &buf, &len) < 0)
+			return -1;
+		return srt_parse(&job->srt, buf, len, job->path);
+	}
+	if (ends_with_mkv(job->path))
+		return mkv_open(&job->srt, job->path);
+	return srt_open(&job->srt, job->path);
+}
+
+static void render_plain(struct pipeline *p, struct batch_job *job)
+{
+	double start = p->stats ? monotonic_seconds() : 0.0;
+	int i;
+
+	for (i = 0; i < job->doc.nchunks; i++) {
+		if (ass_render_chunk(&job->doc, i, NULL) < 0) {
+			job->err = errno ? errno : ENOMEM;
+			break;
+		}
+	}
+	if (p->stats)
+		job->stats.seconds[STATS_LAYOUT] = monotonic_seconds() - start;
+
+	pthread_mutex_lock(&p->lock);
+	p->plain++;
+	pthread_mutex_unlock(&p->lock);
+}
+
+static void parse_stage(struct stage_thread *t)
+{
+	struct pipeline *p = t->p;
+	struct batch_job *job;
+
+	while ((job = queue_pop(&p->parse_q)) != NULL) {
+		double start = monotonic_seconds();
+
+		mem_set_account(&job->mem[STAGE_PARSE]);
+
+		/* An archive that could not be listed */
+		if (job->err) {
+			finish_job(p, job, -1, job->err);
+			continue;
+		}
+
+		if (job->entry.path && job_up_to_date(p, job)) {
+			job->state = JOB_UP_TO_DATE;
+			t->busy += monotonic_seconds() - start;
+			finish_job(p, job, job->entry.count, 0);
+			continue;
+		}
+
+		errno = 0;
+		if (open_input(p, job) < 0) {
+			t->busy += monotonic_seconds() - start;
+			finish_job(p, job, -1, errno);
+			continue;
+		}
+
+		if (ass_doc_init(&job->doc, job->srt.subs, job->srt.count,
+				 p->cfg) < 0) {
+			release_job_data(job);
+			t->busy += monotonic_seconds() - start;
+			finish_job(p, job, -1, ENOMEM);
+			continue;
+		}
+
+		if (p->stats) {
+			job->stats.seconds[STATS_PARSE] =
+				monotonic_seconds() - start;
+			job->stats.files = 1;
+			job->stats.cues = job->srt.count;
+			job->stats.lines = stats_count_lines(job->srt.subs,
+							     job->srt.count);
+			job->stats.bytes_read = job->size;
+		}
+
+		/* Files without kanji are rendered here, never analyzed */
+		if (!ass_doc_has_kanji(&job->doc)) {
+			render_plain(p, job);
+			t->busy += monotonic_seconds() - start;
+			queue_push(&p->write_q, job);
+			continue;
+		}
+		t->busy += monotonic_seconds() - start;
+
+		/* An empty file still gets a header-only .ass */
+		if (job->doc.nchunks == 0)
+			queue_push(&p->write_q, job);
+		else
+			queue_push(&p->analyze_q, job);
+	}
+	mem_set_account(NULL);
+}
+
+/* Called with the pipeline locked */
+static void deactivate_job(struct pipeline *p, struct batch_job *job)
+{
+	struct batch_job **link;
+
+	for (link = &p->active; *link; link = &(*link)->active_next) {
+		if (*link == job) {
+			*link = job->active_next;
+			break;
+		}
+	}
+}
+
+static int has_stealable_chunks(void *arg)
+{
+	struct pipeline *p = arg;
+	int ret;
+
+	pthread_mutex_lock(&p->lock);
+	ret = p->active != NULL;
+	pthread_mutex_unlock(&p->lock);
+	return ret;
+}
+
+/*
+ * Claim the next chunk to render: the front of the job this analyzer
+ * owns, otherwise the back of the active job with the most chunks left.
+ */
+static struct batch_job *claim_chunk(struct stage_thread *t, int *idx)
+{
+	struct pipeline *p = t->p;
+	struct batch_job *job = NULL, *it;
+
+	pthread_mutex_lock(&p->lock);
+
+	if (t->own && t->own->next_chunk < t->own->end_chunk) {
+		job = t->own;
+		*idx = job->next_chunk++;
+	} else {
+		t->own = NULL;
+		for (it = p->active; it; it = it->active_next) {
+			if (!job || it->end_chunk - it->next_chunk >
+				    job->end_chunk - job->next_chunk)
+				job = it;
+		}
+		if (job) {
+			*idx = --job->end_chunk;
+			p->stolen++;
+		}
+	}
+
+	if (job && job->next_chunk == job->end_chunk)
+		deactivate_job(p, job);
+
+	pthread_mutex_unlock(&p->lock);
+	return job;
+}
+
+static void activate_job(struct stage_thread *t, struct batch_job *job)
+{
+	struct pipeline *p = t->p;
+
+	pthread_mutex_lock(&p->lock);
+	job->next_chunk = 0;
+	job->end_chunk = job->doc.nchunks;
+	job->pending = job->doc.nchunks;
+	job->active_next = p->active;
+	p->active = job;
+	t->own = job;
+	pthread_mutex_unlock(&p->lock);
+
+	/* Let analyzers waiting for a file steal from this one instead */
+	if (job->doc.nchunks > 1)
+		queue_wake(&p->analyze_q);
+}
+
+static void analyze_stage(struct stage_thread *t)
+{
+	struct pipeline *p = t->p;
+
+	if (p->stats)
+		t->an->stats = &t->stats;
+
+	for (;;) {
+		struct batch_job *job;
+		double start;
+		int idx, ret, last;
+
+		job = claim_chunk(t, &idx);
+		if (!job) {
+			job = queue_pop_cancel(&p->analyze_q,
+					       has_stealable_chunks, p);
+			if (job)
+				activate_job(t, job);
+			else if (queue_drained(&p->analyze_q) &&
+				 !has_stealable_chunks(p))
+				break;
+			continue;
+		}
+
+		if (p->stats)
+			memset(&t->stats, 0, sizeof(t->stats));
+
+		start = monotonic_seconds();
+		mem_set_account(&job->mem[STAGE_ANALYZE]);
+		ret = ass_render_chunk(&job->doc, idx, t->an);
+		mem_set_account(NULL);
+		t->busy += monotonic_seconds() - start;
+
+		pthread_mutex_lock(&p->lock);
+		if (p->stats)
+			stats_add(&job->stats, &t->stats);
+		if (ret < 0)
+			job->err = errno ? errno : ENOMEM;
+		last = --job->pending == 0;
+		pthread_mutex_unlock(&p->lock);
+
+		if (last)
+			queue_push(&p->write_q, job);
+	}
+
+	t->finished = monotonic_seconds();
+}
+
+static void record_output(struct batch_job *job)
+{
+	struct stat st;
+
+	if (stat(job->out, &st) < 0) {
+		free(job->entry.path);
+		job->entry.path = NULL;
+		return;
+	}
+
+	job->entry.count = job->srt.count;
+	job->entry.out_size = st.st_size;
+	job->entry.out_mtime = st.st_mtim;
+}
+
+static int write_output(struct pipeline *p, struct batch_job *job)
+{
+	if (job->zip)
+		return ass_doc_write_zip(&job->doc, job->zip, job->out);
+
+	/* Members of an archive may be in folders of their own */
+	if (job->archive && make_parent_dirs(job->out) < 0)
+		return -1;
+	return ass_doc_write(&job->doc, job->out, p->manifest != NULL);
+}
+
+static void write_stage(struct stage_thread *t)
+{
+	struct pipeline *p = t->p;
+	struct batch_job *job;
+
+	while ((job = queue_pop(&p->write_q)) != NULL) {
+		double start = monotonic_seconds();
+		int count = job->srt.count;
+		int err = job->err;
+		int ret;
+
+		/* Lines left without furigana when an allocation was refused */
+		if (!err && job->mem_file.refused)
+			err = ENOMEM;
+
+		mem_set_account(&job->mem[STAGE_WRITE]);
+		ret = err ? -1 : write_output(p, job);
+		mem_set_account(NULL);
+		if (p->stats) {
+			job->stats.seconds[STATS_WRITE] =
+				monotonic_seconds() - start;
+			job->stats.bytes_written = job->doc.written;
+		}
+		if (ret < 0) {
+			count = -1;
+			err = err ? err : errno;
+		} else if (job->entry.path) {
+			record_output(job);
+		}
+		if (ret > 0)
+			job->state = JOB_UNCHANGED;
+
+		release_job_data(job);
+		t->busy += monotonic_seconds() - start;
+		finish_job(p, job, count, err);
+	}
+}
+
+/*
+ * Release the producer slots that @n threads of @stage hold on the
+ * queues downstream of it.
+ */
+static void close_stage_outputs(struct pipeline *p, enum stage_id stage, int n)
+{
+	while (n-- > 0) {
+		switch (stage) {
+		case STAGE_WALK:
+			queue_close(&p->parse_q);
+			break;
+		case STAGE_PARSE:
+			queue_close(&p->analyze_q);
+			queue_close(&p->write_q);
+			break;
+		case STAGE_ANALYZE:
+			queue_close(&p->write_q);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static void *stage_thread_main(void *arg)
+{
+	struct stage_thread *t = arg;
+	struct pipeline *p = t->p;
+
+	switch (t->stage) {
+	case STAGE_WALK:
+		walk_stage(t);
+		break;
+	case STAGE_PARSE:
+		parse_stage(t);
+		break;
+	case STAGE_ANALYZE:
+		analyze_stage(t);
+		break;
+	default:
+		write_stage(t);
+		break;
+	}
+
+	close_stage_outputs(p, t->stage, 1);
+
+	pthread_mutex_lock(&p->lock);
+	p->stages[t->stage].busy += t->busy;
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+static void report_job(const struct batch_job *job)
+{
+	if (job->count >= 0) {
+		if (job->state == JOB_UP_TO_DATE)
+			printf("Up to date: %s\n", job->path);
+		else if (job->state == JOB_UNCHANGED)
+			printf("Unchanged: %s (%d subtitles)\n", job->path,
+			       job->count);
+		else
+			printf("Processing: %s (%d subtitles)\n", job->path,
+			       job->count);
+		return;
+	}
+
+	fflush(stdout);
+	fprintf(stderr, "Cannot convert: %s (%s)\n", job->path,
+		job->mem_file.refused ? "memory budget exceeded" :
+					strerror(job->err));
+}
+
+/*
+ * Report the stats of a converted job, and add them to the totals.
+ */
+static void report_job_stats(struct pipeline *p, const struct batch_job *job)
+{
+	if (job->count < 0 || job->state == JOB_UP_TO_DATE)
+		return;
+
+	if (p->print_stats)
+		stats_print(stdout, &job->stats, -1.0);
+	if (p->stats_json)
+		stats_print_json(p->stats_json, job->path, &job->stats, 0.0);
+	stats_add(&p->total, &job->stats);
+}
+
+/*
+ * Print what each stage of a job allocated and the peak it reached,
+ * and add them to the totals.
+ */
+static void report_job_mem(struct pipeline *p, const struct batch_job *job)
+{
+	const struct batch_job *max = p->mem_largest;
+	int s;
+
+	if (job->state == JOB_UP_TO_DATE)
+		return;
+
+	fputs("  memory: ", stdout);
+	for (s = STAGE_PARSE; s < NR_STAGES; s++) {
+		mem_print(stdout, stage_names[s], &job->mem[s]);
+		fputs("; ", stdout);
+		mem_add(&p->mem_total[s], &job->mem[s]);
+	}
+	mem_print(stdout, "file", &job->mem_file);
+	putchar('\n');
+
+	if (!max || job->mem_file.peak > max->mem_file.peak)
+		p->mem_largest = job;
+}
+
+/*
+ * Print the allocations of each stage over the run, each with the
+ * highest peak a single file reached in it, then the peak of the run:
+ * what the files converted at the same time held together. What the
+ * analyzers keep from file to file is counted apart.
+ */
+static void report_total_mem(struct pipeline *p)
+{
+	int s;
+
+	printf("\nMemory: ");
+	mem_print(stdout, "run", &p->mem_run);
+	printf(", %ld refused over the budget; ", p->mem_run.refused);
+	mem_print(stdout, "analyzers", &p->mem_analyzers);
+	fputs("\n  ", stdout);
+
+	for (s = STAGE_PARSE; s < NR_STAGES; s++) {
+		mem_print(stdout, stage_names[s], &p->mem_total[s]);
+		fputs(s + 1 < NR_STAGES ? "; " : "\n", stdout);
+	}
+
+	if (p->mem_largest) {
+		printf("  largest file: %s, ", p->mem_largest->path);
+		mem_print(stdout, "", &p->mem_largest->mem_file);
+		putchar('\n');
+	}
+}
+
+/*
+ * Report the totals of the run. Walk time is the walker's, which the
+ * jobs do not share.
+ */
+static void report_total_stats(struct pipeline *p, double wall)
+{
+	p->total.seconds[STATS_WALK] = p->stages[STAGE_WALK].busy;
+
+	if (p->print_stats)
+		stats_print(stdout, &p->total, wall);
+	if (p->stats_json)
+		stats_print_json(p->stats_json, NULL, &p->total, wall);
+}
+
+/*
+ * Print how busy each stage was and how full its input queue ran. The
+ * stage with the highest busy ratio is the bottleneck; time spent
+ * blocked on a full input queue shows upstream stages waiting on it.
+ */
+static void report_pipeline(struct pipeline *p, double wall)
+{
+	int s;
+
+	printf("\nPipeline report (%.2f s):\n", wall);
+	printf("  %-8s %7s %7s %15s %13s\n",
+	       "stage", "threads", "busy", "queue depth", "blocked full");
+
+	for (s = 0; s < NR_STAGES; s++) {
+		struct stage *st = &p->stages[s];
+		double busy = 0.0;
+
+		if (wall > 0.0 && st->started > 0)
+			busy = 100.0 * st->busy / (wall * st->started);
+
+		if (!st->in) {
+			printf("  %-8s %7d %6.1f%% %15s %13s\n",
+			       stage_names[s], st->started, busy, "-", "-");
+			continue;
+		}
+
+		printf("  %-8s %7d %6.1f%% %8.1f / %-4d %11.2f s\n",
+		       stage_names[s], st->started, busy,
+		       wall > 0.0 ? st->in->depth_area / wall : 0.0,
+		       st->in->capacity, st->in->full_wait);
+	}
+}
+
+/*
+ * Print the makespan (start to last file written) and how well the
+ * analyzers were kept busy over it. The idle tail is the time between
+ * the first and the last analyzer running out of work.
+ */
+static void report_schedule(struct pipeline *p, struct stage_thread *analyzers)
+{
+	struct stage *st = &p->stages[STAGE_ANALYZE];
+	double makespan = p->last_done - p->start;
+	double first = 0.0, last = 0.0;
+	double util = 0.0;
+	int i;
+
+	for (i = 0; i < st->started; i++) {
+		if (i == 0 || analyzers[i].finished < first)
+			first = analyzers[i].finished;
+		if (i == 0 || analyzers[i].finished > last)
+			last = analyzers[i].finished;
+	}
+
+	if (makespan > 0.0 && st->started > 0)
+		util = 100.0 * st->busy / (makespan * st->started);
+
+	printf("\nSchedule: largest first, %d files, %d chunks stolen, "
+	       "%d without kanji\n", p->nfiles, p->stolen, p->plain);
+	printf("  makespan %.2f s, analyzer utilization %.1f%%, "
+	       "idle tail %.2f s\n", makespan > 0.0 ? makespan : 0.0, util,
+	       last - first);
+}
+
+static void report_walk(const struct walk_stats *w)
+{
+	if (w->dirs == 0)
+		return;
+
+	printf("\nWalk: %ld entries in %ld folders, %ld stat calls, "
+	       "%ld files (%.0f entries/s)\n", w->entries, w->dirs, w->stats,
+	       w->files, w->seconds > 0.0 ? w->entries / w->seconds : 0.0);
+}
+
+static void report_cache(struct line_cache *cache)
+{
+	struct line_cache_stats st;
+	long lookups;
+
+	if (!cache) {
+		printf("\nLine cache: disabled\n");
+		return;
+	}
+
+	line_cache_get_stats(cache, &st);
+	lookups = st.hits + st.misses;
+
+	printf("\nLine cache: %ld hits, %ld misses (%.1f%% hit rate)\n",
+	       st.hits, st.misses, lookups ? 100.0 * st.hits / lookups : 0.0);
+	printf("  %ld entries, %ld evictions\n", st.entries, st.evictions);
+}
+
+static void report_disk_cache(struct disk_cache *dc)
+{
+	struct disk_cache_stats st;
+
+	disk_cache_get_stats(dc, &st);
+	printf("\nDisk cache: %ld records loaded, %ld hits, %ld misses, "
+	       "%ld appended\n", st.loaded, st.hits, st.misses, st.appended);
+}
+
+/*
+ * Record the outcome of every job in the manifest and save it.
+ */
+static void update_manifest(struct pipeline *p, const char *path)
+{
+	int counts[3] = {0, 0, 0};
+	struct batch_job *job;
+
+	for (job = p->head; job; job = job->next) {
+		if (!job->entry.path)
+			continue;
+
+		if (job->count < 0) {
+			manifest_remove(p->manifest, job->entry.path);
+			continue;
+		}
+
+		counts[job->state]++;
+		if (manifest_set(p->manifest, &job->entry) < 0)
+			manifest_remove(p->manifest, job->entry.path);
+	}
+
+	if (manifest_save(p->manifest, path) < 0)
+		fprintf(stderr, "Cannot save manifest %s: %s\n", path,
+			strerror(errno));
+
+	printf("\nIncremental: %d converted, %d up to date, "
+	       "%d unchanged\n", counts[JOB_CONVERTED],
+	       counts[JOB_UP_TO_DATE], counts[JOB_UNCHANGED]);
+}
+
+static int start_stage(struct pipeline *p, struct stage_thread *threads,
+		       enum stage_id stage)
+{
+	struct stage *st = &p->stages[stage];
+
+	for (st->started = 0; st->started < st->nthreads; st->started++) {
+		struct stage_thread *t = &threads[st->started];
+
+		t->p = p;
+		t->stage = stage;
+		if (pthread_create(&t->thread, NULL, stage_thread_main, t) != 0)
+			break;
+	}
+
+	close_stage_outputs(p, stage, st->nthreads - st->started);
+	return st->started > 0 ? 0 : -1;
+}
+
+/*
+ * Convert every file below the recorded roots. Analyzers share @model
+ * and the line cache, and each reuse their own lattice for every line.
+ * Returns the number of files that failed, or -1 if the pipeline could
+ * not be started.
+ */
+int batch_run(struct batch *b, struct font_config *cfg, mecab_model_t *model,
+	      const struct batch_opts *opts)
+{
+	static const enum stage_id start_order[NR_STAGES] = {
+		STAGE_WRITE, STAGE_ANALYZE, STAGE_PARSE, STAGE_WALK
+	};
+	struct pipeline p;
+	struct stage_thread *threads[NR_STAGES] = {0};
+	struct analyzer *an;
+	struct line_cache *cache = NULL;
+	struct disk_cache *disk = NULL;
+	struct manifest manifest;
+	struct batch_job **link, *job;
+	uint64_t fp;
+	int failed = 0;
+	int s, i;
+
+	if (b->count == 0)
+		return 0;
+
+	memset(&p, 0, sizeof(p));
+	p.b = b;
+	p.cfg = cfg;
+	p.cfg_hash = config_hash(cfg);
+	p.tail = &p.head;
+	p.zip_output = opts->zip_output;
+	p.stats = opts->stats || opts->stats_json;
+	p.print_stats = opts->stats;
+	p.print_mem = opts->mem_stats;
+	p.mem_budget = opts->mem_budget;
+	p.stages[STAGE_WALK].nthreads = 1;
+	p.walkers = opts->walkers > 0 ? opts->walkers : 1;
+	p.stages[STAGE_PARSE].nthreads = opts->parsers > 0 ? opts->parsers : 1;
+	p.stages[STAGE_ANALYZE].nthreads =
+		opts->analyzers > 0 ? opts->analyzers : 1;
+	p.stages[STAGE_WRITE].nthreads = opts->writers > 0 ? opts->writers : 1;
+	p.stages[STAGE_PARSE].in = &p.parse_q;
+	p.stages[STAGE_ANALYZE].in = &p.analyze_q;
+	p.stages[STAGE_WRITE].in = &p.write_q;
+
+	an = calloc(p.stages[STAGE_ANALYZE].nthreads, sizeof(struct analyzer));
+	if (!an)
+		return -1;
+
+	fp = dictionary_fingerprint(model, opts->reading_field);
+
+	/* Without memory for it, run uncached */
+	if (opts->cache_lines > 0)
+		cache = line_cache_new(opts->cache_lines);
+	if (opts->disk_cache)
+		disk = disk_cache_open(opts->disk_cache, fp);
+
+	if (opts->stats_json) {
+		p.stats_json = fopen(opts->stats_json, "w");
+		if (!p.stats_json) {
+			fprintf(stderr, "Cannot write %s: %s\n",
+				opts->stats_json, strerror(errno));
+			failed = -1;
+			goto out_analyzers;
+		}
+	}
+
+	/* Readings depend on the dictionary as much as on the settings */
+	if (opts->manifest) {
+		if (manifest_load(&manifest, opts->manifest) < 0) {
+			fprintf(stderr, "Cannot read manifest %s: %s\n",
+				opts->manifest, strerror(errno));
+			failed = -1;
+			goto out_analyzers;
+		}
+		p.manifest = &manifest;
+		p.cfg_hash = hash_bytes(&fp, sizeof(fp), p.cfg_hash);
+	}
+
+	/*
+	 * Analyzers outlive every file, so their reading caches and arena
+	 * blocks are charged to the run, whichever file makes them grow.
+	 */
+	mem_set_account(&p.mem_analyzers);
+	for (i = 0; i < p.stages[STAGE_ANALYZE].nthreads; i++) {
+		if (analyzer_init(&an[i], model, opts->reading_field) < 0) {
+			mem_set_account(NULL);
+			fprintf(stderr, "MeCab initialization failed\n");
+			failed = -1;
+			goto out_analyzers;
+		}
+		an[i].cache = cache;
+		an[i].disk = disk;
+	}
+	mem_set_account(NULL);
+
+	for (s = 0; s < NR_STAGES; s++) {
+		threads[s] = calloc(p.stages[s].nthreads,
+				    sizeof(struct stage_thread));
+		if (!threads[s]) {
+			failed = -1;
+			goto out_threads;
+		}
+	}
+	for (i = 0; i < p.stages[STAGE_ANALYZE].nthreads; i++)
+		threads[STAGE_ANALYZE][i].an = &an[i];
+
+	if (queue_init(&p.parse_q, PARSE_QUEUE_DEPTH,
+		       p.stages[STAGE_WALK].nthreads) < 0) {
+		failed = -1;
+		goto out_threads;
+	}
+	if (queue_init(&p.analyze_q, ANALYZE_QUEUE_DEPTH,
+		       p.stages[STAGE_PARSE].nthreads) < 0) {
+		failed = -1;
+		goto out_parse_q;
+	}
+	if (queue_init(&p.write_q, WRITE_QUEUE_DEPTH,
+		       p.stages[STAGE_PARSE].nthreads +
+		       p.stages[STAGE_ANALYZE].nthreads) < 0) {
+		failed = -1;
+		goto out_analyze_q;
+	}
+
+	pthread_mutex_init(&p.lock, NULL);
+	pthread_cond_init(&p.changed, NULL);
+	p.start = monotonic_seconds();
+	p.last_done = p.start;
+
+	/*
+	 * Consumers first, so every queue has a reader before anything is
+	 * pushed to it. If a stage cannot start, the stages upstream of it
+	 * are not started either and the run is abandoned.
+	 */
+	for (s = 0; s < NR_STAGES; s++) {
+		if (start_stage(&p, threads[start_order[s]], start_order[s]) == 0)
+			continue;
+
+		fprintf(stderr, "Cannot start worker threads\n");
+		failed = -1;
+		for (s++; s < NR_STAGES; s++)
+			close_stage_outputs(&p, start_order[s],
+					    p.stages[start_order[s]].nthreads);
+		pthread_mutex_lock(&p.lock);
+		p.walk_done = 1;
+		pthread_mutex_unlock(&p.lock);
+		break;
+	}
+
+	/*
+	 * Report in discovery order while the stages keep going. Jobs are
+	 * only in that order once the walk is done, and none can finish
+	 * before.
+	 */
+	for (link = &p.head;; link = &job->next) {
+		pthread_mutex_lock(&p.lock);
+		while (!p.walk_done)
+			pthread_cond_wait(&p.changed, &p.lock);
+		job = *link;
+		while (job && !job->done)
+			pthread_cond_wait(&p.changed, &p.lock);
+		pthread_mutex_unlock(&p.lock);
+
+		if (!job)
+			break;
+
+		report_job(job);
+		if (p.stats)
+			report_job_stats(&p, job);
+		if (p.print_mem)
+			report_job_mem(&p, job);
+		if (job->count < 0 && failed >= 0)
+			failed++;
+	}
+
+	for (s = 0; s < NR_STAGES; s++) {
+		for (i = 0; i < p.stages[s].started; i++)
+			pthread_join(threads[s][i].thread, NULL);
+	}
+
+	if (p.nzips > 1)
+		qsort(p.zips, p.nzips, sizeof(*p.zips), compare_zips);
+	for (i = 0; i < p.nzips; i++) {
+		if (zip_out_write(p.zips[i]) < 0) {
+			fprintf(stderr, "Cannot write %s: %s\n",
+				zip_out_path(p.zips[i]), strerror(errno));
+			if (failed >= 0)
+				failed++;
+		} else {
+			printf("Archived: %s\n", zip_out_path(p.zips[i]));
+		}
+		zip_out_free(p.zips[i]);
+	}
+	free(p.zips);
+
+	if (p.manifest && failed >= 0)
+		update_manifest(&p, opts->manifest);
+
+	if (opts->report && failed >= 0) {
+		report_pipeline(&p, monotonic_seconds() - p.start);
+		report_walk(&p.walk);
+		report_schedule(&p, threads[STAGE_ANALYZE]);
+		report_cache(cache);
+		if (disk)
+			report_disk_cache(disk);
+	}
+
+	if (p.stats && failed >= 0)
+		report_total_stats(&p, monotonic_seconds() - p.start);
+	if (p.print_mem && failed >= 0)
+		report_total_mem(&p);
+
+	pthread_cond_destroy(&p.changed);
+	pthread_mutex_destroy(&p.lock);
+	queue_destroy(&p.write_q);
+out_analyze_q:
+	queue_destroy(&p.analyze_q);
+out_parse_q:
+	queue_destroy(&p.parse_q);
+out_threads:
+	for (s = 0; s < NR_STAGES; s++)
+		free(threads[s]);
+out_analyzers:
+	for (i = 0; i < p.stages[STAGE_ANALYZE].nthreads; i++)
+		analyzer_destroy(&an[i]);
+	free(an);
+
+	/* Analyzers may hold memory charged to a job until now */
+	while (p.head) {
+		job = p.head;
+		p.head = job->next;
+		free(job->entry.path);
+		free(job->path);
+		free(job->out);
+		free(job->archive);
+		mem_free(job->member.data);
+		free(job);
+	}
+	if (p.manifest)
+		manifest_free(p.manifest);
+	line_cache_free(cache);
+	disk_cache_close(disk);
+	if (p.stats_json && fclose(p.stats_json) != 0) {
+		fprintf(stderr, "Cannot write %s: %s\n", opts->stats_json,
+			strerror(errno));
+		if (failed >= 0)
+			failed++;
+	}
+	return failed;
+}
+
+/*
+ * Convert standard input to standard output as cues arrive. There is a
+ * single analyzer, as cues have to be written in order anyway, but the
+ * line and disk caches are used as in a batch.
+ */
+int batch_stream(struct font_config *cfg, mecab_model_t *model,
+		 const struct batch_opts *opts)
+{
+	struct srt_stream in;
+	struct analyzer an;
+	struct line_cache *cache = NULL;
+	struct disk_cache *disk = NULL;
+	uint64_t fp = dictionary_fingerprint(model, opts->reading_field);
+	int ret;
+
+	if (analyzer_init(&an, model, opts->reading_field) < 0) {
+		fprintf(stderr, "MeCab initialization failed\n");
+		return -1;
+	}
+
+	if (opts->cache_lines > 0)
+		cache = line_cache_new(opts->cache_lines);
+	if (opts->disk_cache)
+		disk = disk_cache_open(opts->disk_cache, fp);
+	an.cache = cache;
+	an.disk = disk;
+
+	srt_stream_init(&in, stdin, "<stdin>");
+	ret = ass_stream(&in, stdout, cfg, &an);
+	if (ret < 0)
+		fprintf(stderr, "Cannot convert standard input: %s\n",
+			strerror(errno ? errno : EIO));
+	srt_stream_free(&in);
+
+	analyzer_destroy(&an);
+	line_cache_free(cache);
+	disk_cache_close(disk);
+	return ret;
+}
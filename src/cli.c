@@ -11,6 +11,8 @@
 
 #include "cli.h"
 #include "utils.h"
+#include "mecab_helpers.h"
+#include "batch.h"
 
 #define INPUT_SIZE	512
 #define FONT_MIN	16
@@ -51,7 +53,7 @@ static int next_path(char **cursor, char *out, int max_len)
 	return i;
 }
 
-static int process_path(const char *path, struct cli_ctx *ctx)
+static int queue_path(const char *path, struct batch *b)
 {
 	struct stat st;
 
@@ -60,24 +62,26 @@ static int process_path(const char *path, struct cli_ctx *ctx)
 		return -1;
 	}
 
-	if (S_ISDIR(st.st_mode)) {
+	if (S_ISDIR(st.st_mode))
 		printf("Scanning folder: %s\n", path);
-		scan_directory(path, ctx->cfg, ctx->mecab);
-		return 1;
-	}
 
-	if (ends_with_srt(path)) {
-		process_file(path, ctx->cfg, ctx->mecab);
+	switch (batch_add_path(b, path)) {
+	case 1:
 		return 1;
+	case 0:
+		fprintf(stderr, "Not a .srt, .mkv or archive file: %s\n", path);
+		return 0;
+	default:
+		fprintf(stderr, "  ✗ Cannot access: %s\n", path);
+		return -1;
 	}
-
-	fprintf(stderr, "Not a .srt file: %s\n", path);
-	return 0;
 }
 
 static void cmd_convert(struct cli_ctx *ctx)
 {
 	char input[INPUT_SIZE], path[INPUT_SIZE];
+	struct batch b = {0};
+	struct batch_opts opts;
 	char *cursor;
 	int count = 0;
 
@@ -114,10 +118,14 @@ static void cmd_convert(struct cli_ctx *ctx)
 	printf("\n");
 	cursor = input;
 	while (next_path(&cursor, path, sizeof(path))) {
-		if (process_path(path, ctx) > 0)
+		if (queue_path(path, &b) > 0)
 			count++;
 	}
 
+	batch_default_opts(&opts);
+	batch_run(&b, ctx->cfg, ctx->model, &opts);
+	batch_free(&b);
+
 	printf("\nProcessed %d item(s).\n", count);
 }
 
@@ -210,11 +218,9 @@ static int menu_loop(struct cli_ctx *ctx)
 
 int cli_init(struct cli_ctx *ctx)
 {
-	ctx->mecab = mecab_new2("");
-	if (!ctx->mecab) {
-		fprintf(stderr, "MeCab initialization failed\n");
+	ctx->model = load_mecab_model();
+	if (!ctx->model)
 		return -1;
-	}
 
 	ctx->cfg = get_default_config();
 	return 0;
@@ -222,8 +228,8 @@ int cli_init(struct cli_ctx *ctx)
 
 void cli_cleanup(struct cli_ctx *ctx)
 {
-	if (ctx->mecab)
-		mecab_destroy(ctx->mecab);
+	if (ctx->model)
+		mecab_model_destroy(ctx->model);
 }
 
 int cli_run(struct cli_ctx *ctx)
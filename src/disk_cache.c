@@ -0,0 +1,709 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - disk_cache.c
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ *
+ * Persistent cache of the readings MeCab found for a line, so that
+ * reconverting a library with another layout only redoes the layout.
+ *
+ * The file is a header followed by self-checking records that are only
+ * ever appended. It is mapped read-only when a batch starts and indexed
+ * in memory; lines analyzed during the run are appended under a write
+ * lock, one write() per record. Readers take a read lock only while
+ * mapping, so any number of runs may share the file. Each record carries
+ * the fingerprint of the dictionary that produced it, and records made
+ * with another dictionary are ignored.
+ *
+ * Compaction keeps the first record of each line made with the current
+ * dictionary, writes them to a new file and renames it over the old one.
+ * Runs still mapping the old file are not disturbed; their next append
+ * notices the rename and goes to the new file.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "disk_cache.h"
+#include "arena.h"
+#include "utils.h"
+
+#define DC_MAGIC		"F4SDC\0\0\1"
+#define DC_MAGIC_LEN		8
+#define DC_BYTE_ORDER		0x01020304
+
+struct dc_header {
+	char magic[DC_MAGIC_LEN];
+	uint32_t byte_order;	/* records use the writer's byte order */
+	uint32_t reserved;
+};
+
+/*
+ * Record - followed by the line text and @ntokens dc_token entries,
+ * each followed by its reading. @check covers everything after itself.
+ */
+struct dc_record {
+	uint32_t len;		/* whole record, in bytes */
+	uint32_t check;
+	uint64_t fingerprint;
+	uint64_t hash;		/* of the line text */
+	uint32_t line_len;
+	uint32_t ntokens;
+};
+
+struct dc_token {
+	int32_t start_char;
+	int32_t char_len;
+	uint32_t reading_len;
+};
+
+/*
+ * Index - open addressing table from line hash to record offset. Offset
+ * 0 marks an empty slot, as no record starts inside the header.
+ */
+struct dc_slot {
+	uint64_t hash;
+	size_t off;
+};
+
+struct dc_index {
+	struct dc_slot *slots;
+	size_t mask;
+	long count;
+};
+
+struct disk_cache {
+	char *path;
+	uint64_t fingerprint;
+	int fd;			/* appends go here */
+	const char *map;
+	size_t map_len;
+	struct dc_index index;	/* read-only once opened */
+
+	pthread_mutex_t lock;	/* appends and counters */
+	struct dc_index added;	/* lines appended by this run */
+	long hits;
+	long misses;
+	long appended;
+};
+
+static int lock_file(int fd, short type)
+{
+	struct flock fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+
+	while (fcntl(fd, F_SETLKW, &fl) < 0) {
+		if (errno != EINTR)
+			return -1;
+	}
+	return 0;
+}
+
+static uint32_t record_check(const char *rec, size_t len)
+{
+	return (uint32_t)hash_bytes(rec + 8, len - 8, HASH_SEED);
+}
+
+/*
+ * Check that the record at @off is complete and intact.
+ * Returns its length, or 0 if it is not.
+ */
+static size_t record_valid(const char *map, size_t len, size_t off)
+{
+	struct dc_record r;
+	size_t pos, end;
+	uint32_t i;
+
+	if (len - off < sizeof(r))
+		return 0;
+
+	memcpy(&r, map + off, sizeof(r));
+	if (r.len < sizeof(r) || r.len > len - off)
+		return 0;
+	if (record_check(map + off, r.len) != r.check)
+		return 0;
+
+	end = off + r.len;
+	pos = off + sizeof(r) + r.line_len;
+	if (r.line_len > r.len - sizeof(r))
+		return 0;
+
+	for (i = 0; i < r.ntokens; i++) {
+		struct dc_token t;
+
+		if (end - pos < sizeof(t))
+			return 0;
+		memcpy(&t, map + pos, sizeof(t));
+		pos += sizeof(t);
+		if (t.reading_len > end - pos)
+			return 0;
+		pos += t.reading_len;
+	}
+	return r.len;
+}
+
+static int index_init(struct dc_index *ix, long expected)
+{
+	size_t n = 16;
+
+	while (n < (size_t)expected * 2)
+		n <<= 1;
+
+	ix->slots = calloc(n, sizeof(struct dc_slot));
+	if (!ix->slots)
+		return -1;
+	ix->mask = n - 1;
+	ix->count = 0;
+	return 0;
+}
+
+static int index_grow(struct dc_index *ix)
+{
+	struct dc_index big;
+	size_t i;
+
+	if (index_init(&big, (ix->mask + 1)) < 0)
+		return -1;
+
+	for (i = 0; i <= ix->mask; i++) {
+		struct dc_slot *s = &ix->slots[i];
+		size_t j;
+
+		if (!s->off)
+			continue;
+		for (j = s->hash & big.mask; big.slots[j].off;
+		     j = (j + 1) & big.mask)
+			;
+		big.slots[j] = *s;
+		big.count++;
+	}
+
+	free(ix->slots);
+	*ix = big;
+	return 0;
+}
+
+/*
+ * Find the record of @line in @map. Returns its offset, or 0.
+ */
+static size_t index_find(const struct dc_index *ix, const char *map,
+			 uint64_t hash, const char *line, size_t len)
+{
+	size_t i;
+
+	for (i = hash & ix->mask; ix->slots[i].off; i = (i + 1) & ix->mask) {
+		struct dc_record r;
+
+		if (ix->slots[i].hash != hash)
+			continue;
+		if (!map)
+			return ix->slots[i].off;
+
+		memcpy(&r, map + ix->slots[i].off, sizeof(r));
+		if (r.line_len == len &&
+		    memcmp(map + ix->slots[i].off + sizeof(r), line, len) == 0)
+			return ix->slots[i].off;
+	}
+	return 0;
+}
+
+static int index_insert(struct dc_index *ix, uint64_t hash, size_t off)
+{
+	size_t i;
+
+	if ((size_t)(ix->count + 1) * 2 > ix->mask + 1 && index_grow(ix) < 0)
+		return -1;
+
+	for (i = hash & ix->mask; ix->slots[i].off; i = (i + 1) & ix->mask)
+		;
+	ix->slots[i].hash = hash;
+	ix->slots[i].off = off;
+	ix->count++;
+	return 0;
+}
+
+/*
+ * Index the first record of each line made with @fingerprint.
+ * Returns the offset where the valid records end, or 0 on failure.
+ */
+static size_t index_records(struct dc_index *ix, const char *map, size_t len,
+			    uint64_t fingerprint, long *total)
+{
+	size_t off = sizeof(struct dc_header);
+	size_t rlen;
+
+	*total = 0;
+	if (index_init(ix, 0) < 0)
+		return 0;
+
+	while ((rlen = record_valid(map, len, off)) != 0) {
+		struct dc_record r;
+
+		memcpy(&r, map + off, sizeof(r));
+		(*total)++;
+
+		if (r.fingerprint == fingerprint &&
+		    !index_find(ix, map, r.hash, map + off + sizeof(r),
+				r.line_len) &&
+		    index_insert(ix, r.hash, off) < 0) {
+			free(ix->slots);
+			ix->slots = NULL;
+			return 0;
+		}
+		off += rlen;
+	}
+	return off;
+}
+
+static int check_header(const char *map, size_t len)
+{
+	struct dc_header h;
+
+	if (len < sizeof(h))
+		return -1;
+	memcpy(&h, map, sizeof(h));
+	if (memcmp(h.magic, DC_MAGIC, DC_MAGIC_LEN) != 0 ||
+	    h.byte_order != DC_BYTE_ORDER)
+		return -1;
+	return 0;
+}
+
+static int write_header(int fd)
+{
+	struct dc_header h;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, DC_MAGIC, DC_MAGIC_LEN);
+	h.byte_order = DC_BYTE_ORDER;
+
+	return write(fd, &h, sizeof(h)) == sizeof(h) ? 0 : -1;
+}
+
+/*
+ * Map the cache at @path, creating it if needed. Returns NULL, with a
+ * message, if it cannot be used; the batch then runs without it.
+ */
+struct disk_cache *disk_cache_open(const char *path, uint64_t fingerprint)
+{
+	struct disk_cache *dc;
+	struct stat st;
+	size_t end;
+	long total;
+	void *map;
+
+	dc = calloc(1, sizeof(struct disk_cache));
+	if (!dc)
+		return NULL;
+
+	pthread_mutex_init(&dc->lock, NULL);
+	dc->fingerprint = fingerprint;
+	dc->path = strdup(path);
+	dc->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (!dc->path || dc->fd < 0)
+		goto fail;
+
+	if (lock_file(dc->fd, F_WRLCK) < 0 || fstat(dc->fd, &st) < 0)
+		goto fail;
+
+	if (st.st_size == 0) {
+		if (write_header(dc->fd) < 0)
+			goto fail;
+		st.st_size = sizeof(struct dc_header);
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, dc->fd, 0);
+	if (map == MAP_FAILED)
+		goto fail;
+
+	dc->map = map;
+	dc->map_len = st.st_size;
+
+	if (check_header(dc->map, dc->map_len) < 0) {
+		fprintf(stderr, "Not a furigana cache file: %s\n", path);
+		disk_cache_close(dc);
+		return NULL;
+	}
+
+	end = index_records(&dc->index, dc->map, dc->map_len, fingerprint,
+			    &total);
+	if (!end || index_init(&dc->added, 0) < 0)
+		goto fail;
+
+	/*
+	 * Records past a damaged one cannot be found again, so drop them
+	 * rather than appending after them.
+	 */
+	if (end < dc->map_len) {
+		fprintf(stderr, "Disk cache %s is damaged after %ld records, "
+			"dropping the rest\n", path, total);
+		if (ftruncate(dc->fd, end) < 0)
+			goto fail;
+	}
+
+	lock_file(dc->fd, F_UNLCK);
+	return dc;
+
+fail:
+	/* Closing the descriptor drops the lock */
+	fprintf(stderr, "Cannot use disk cache %s: %s\n", path,
+		strerror(errno ? errno : ENOMEM));
+	disk_cache_close(dc);
+	return NULL;
+}
+
+void disk_cache_close(struct disk_cache *dc)
+{
+	if (!dc)
+		return;
+
+	pthread_mutex_destroy(&dc->lock);
+	if (dc->map)
+		munmap((void *)dc->map, dc->map_len);
+	if (dc->fd >= 0)
+		close(dc->fd);
+	free(dc->index.slots);
+	free(dc->added.slots);
+	free(dc->path);
+	free(dc);
+}
+
+static struct furigana_token *decode_record(const char *rec, struct arena *a,
+					    int *token_count)
+{
+	struct furigana_token *tokens;
+	struct dc_record r;
+	const char *p;
+	uint32_t i;
+
+	memcpy(&r, rec, sizeof(r));
+	p = rec + sizeof(r) + r.line_len;
+
+	tokens = arena_alloc(a, (r.ntokens ? r.ntokens : 1) *
+				sizeof(struct furigana_token));
+	if (!tokens)
+		return NULL;
+
+	for (i = 0; i < r.ntokens; i++) {
+		struct dc_token t;
+
+		memcpy(&t, p, sizeof(t));
+		p += sizeof(t);
+
+		tokens[i].reading = arena_strndup(a, p, t.reading_len);
+		if (!tokens[i].reading)
+			return NULL;
+		tokens[i].start_char = t.start_char;
+		tokens[i].char_len = t.char_len;
+		tokens[i].x = 0.0f;
+		p += t.reading_len;
+	}
+
+	*token_count = r.ntokens;
+	return tokens;
+}
+
+/*
+ * Look up the readings of @line as analyze_text_with_mecab() would
+ * return them, before layout, allocated from @a. Returns 1 on a hit, 0
+ * on a miss.
+ */
+int disk_cache_get(struct disk_cache *dc, const char *line, struct arena *a,
+		   struct furigana_token **tokens, int *token_count)
+{
+	size_t len = strlen(line);
+	uint64_t hash = hash_bytes(line, len, HASH_SEED);
+	size_t off;
+
+	off = index_find(&dc->index, dc->map, hash, line, len);
+	*tokens = off ? decode_record(dc->map + off, a, token_count) : NULL;
+
+	pthread_mutex_lock(&dc->lock);
+	if (*tokens)
+		dc->hits++;
+	else
+		dc->misses++;
+	pthread_mutex_unlock(&dc->lock);
+
+	return *tokens != NULL;
+}
+
+/*
+ * Encode the record of @line in @a, which the analyzer resets for each
+ * line, so appending allocates nothing once the arena has grown.
+ */
+static char *encode_record(struct arena *a, uint64_t fingerprint,
+			   uint64_t hash, const char *line, size_t len,
+			   const struct furigana_token *tokens,
+			   int token_count, size_t *out_len)
+{
+	struct dc_record r;
+	size_t size = sizeof(r) + len;
+	char *buf, *p;
+	int i;
+
+	for (i = 0; i < token_count; i++)
+		size += sizeof(struct dc_token) + strlen(tokens[i].reading);
+
+	buf = arena_alloc(a, size);
+	if (!buf)
+		return NULL;
+
+	p = buf + sizeof(r);
+	memcpy(p, line, len);
+	p += len;
+
+	for (i = 0; i < token_count; i++) {
+		struct dc_token t;
+
+		t.start_char = tokens[i].start_char;
+		t.char_len = tokens[i].char_len;
+		t.reading_len = strlen(tokens[i].reading);
+		memcpy(p, &t, sizeof(t));
+		p += sizeof(t);
+		memcpy(p, tokens[i].reading, t.reading_len);
+		p += t.reading_len;
+	}
+
+	r.len = size;
+	r.check = 0;
+	r.fingerprint = fingerprint;
+	r.hash = hash;
+	r.line_len = len;
+	r.ntokens = token_count;
+	memcpy(buf, &r, sizeof(r));
+
+	r.check = record_check(buf, size);
+	memcpy(buf, &r, sizeof(r));
+
+	*out_len = size;
+	return buf;
+}
+
+/*
+ * Follow the file to its new inode if it was compacted since we opened
+ * it. Called with the append lock held on dc->fd.
+ */
+static void follow_compaction(struct disk_cache *dc)
+{
+	struct stat cur, now;
+	int fd;
+
+	if (fstat(dc->fd, &cur) < 0 || stat(dc->path, &now) < 0)
+		return;
+	if (cur.st_dev == now.st_dev && cur.st_ino == now.st_ino)
+		return;
+
+	fd = open(dc->path, O_RDWR | O_APPEND);
+	if (fd < 0)
+		return;
+	if (lock_file(fd, F_WRLCK) < 0) {
+		close(fd);
+		return;
+	}
+
+	close(dc->fd);
+	dc->fd = fd;
+}
+
+/* Called with dc->lock held */
+static int append_record(struct disk_cache *dc, const char *buf, size_t len)
+{
+	struct stat st;
+	ssize_t n;
+	int ret = 0;
+
+	if (lock_file(dc->fd, F_WRLCK) < 0)
+		return -1;
+
+	follow_compaction(dc);
+
+	if (fstat(dc->fd, &st) < 0) {
+		ret = -1;
+	} else {
+		n = write(dc->fd, buf, len);
+		if (n != (ssize_t)len) {
+			/* Never leave a torn record for the next one to follow */
+			if (n > 0 && ftruncate(dc->fd, st.st_size) < 0)
+				fprintf(stderr, "Disk cache %s is damaged\n",
+					dc->path);
+			ret = -1;
+		}
+	}
+
+	lock_file(dc->fd, F_UNLCK);
+	return ret;
+}
+
+/*
+ * Append the readings of @line, unless this run already did. The record
+ * is encoded in @a.
+ */
+void disk_cache_put(struct disk_cache *dc, const char *line, struct arena *a,
+		    const struct furigana_token *tokens, int token_count)
+{
+	size_t len = strlen(line);
+	uint64_t hash = hash_bytes(line, len, HASH_SEED);
+	size_t rlen;
+	char *buf;
+
+	buf = encode_record(a, dc->fingerprint, hash, line, len, tokens,
+			    token_count, &rlen);
+	if (!buf)
+		return;
+
+	pthread_mutex_lock(&dc->lock);
+
+	/* Without the text at hand, a hash collision only skips a write */
+	if (!index_find(&dc->added, NULL, hash, line, len) &&
+	    append_record(dc, buf, rlen) == 0 &&
+	    index_insert(&dc->added, hash, 1) == 0)
+		dc->appended++;
+
+	pthread_mutex_unlock(&dc->lock);
+}
+
+void disk_cache_get_stats(struct disk_cache *dc, struct disk_cache_stats *st)
+{
+	pthread_mutex_lock(&dc->lock);
+	st->loaded = dc->index.count;
+	st->hits = dc->hits;
+	st->misses = dc->misses;
+	st->appended = dc->appended;
+	pthread_mutex_unlock(&dc->lock);
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * Write the indexed records in file order, coalescing the runs of
+ * records that are kept.
+ */
+static int write_compacted(int fd, const char *map, size_t len,
+			   const struct dc_index *ix, uint64_t fingerprint)
+{
+	size_t off = sizeof(struct dc_header);
+	size_t run = off;
+	size_t rlen;
+
+	if (write_header(fd) < 0)
+		return -1;
+
+	while ((rlen = record_valid(map, len, off)) != 0) {
+		struct dc_record r;
+
+		memcpy(&r, map + off, sizeof(r));
+		if (r.fingerprint != fingerprint ||
+		    index_find(ix, map, r.hash, map + off + sizeof(r),
+			       r.line_len) != off) {
+			if (write_all(fd, map + run, off - run) < 0)
+				return -1;
+			run = off + rlen;
+		}
+		off += rlen;
+	}
+
+	if (write_all(fd, map + run, off - run) < 0)
+		return -1;
+	return fsync(fd);
+}
+
+/*
+ * Rewrite the cache at @path with one record per line made with
+ * @fingerprint, dropping stale, duplicate and damaged records.
+ * Returns 0 on success, -1 with errno set on failure.
+ */
+int disk_cache_compact(const char *path, uint64_t fingerprint, long *kept,
+		       long *dropped)
+{
+	struct dc_index ix = {0};
+	size_t len = strlen(path);
+	struct stat st;
+	void *map = MAP_FAILED;
+	char *tmp;
+	int fd, out, written;
+	int ret = -1;
+	long total;
+
+	tmp = malloc(len + sizeof(".tmp"));
+	if (!tmp)
+		return -1;
+	memcpy(tmp, path, len);
+	strcpy(tmp + len, ".tmp");
+
+	fd = open(path, O_RDWR);
+	if (fd < 0) {
+		free(tmp);
+		return -1;
+	}
+
+	/* Appenders wait here and then follow the rename */
+	if (lock_file(fd, F_WRLCK) < 0 || fstat(fd, &st) < 0)
+		goto out;
+
+	if (st.st_size > 0)
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED || check_header(map, st.st_size) < 0) {
+		errno = map == MAP_FAILED && st.st_size > 0 ? errno : EINVAL;
+		goto out;
+	}
+
+	if (!index_records(&ix, map, st.st_size, fingerprint, &total)) {
+		errno = ENOMEM;
+		goto out;
+	}
+
+	out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out < 0)
+		goto out;
+
+	/* Closed even if the copy failed; a failed close fails it too */
+	written = write_compacted(out, map, st.st_size, &ix, fingerprint);
+	if (close(out) < 0)
+		written = -1;
+	if (written < 0) {
+		unlink(tmp);
+		goto out;
+	}
+
+	if (rename(tmp, path) < 0) {
+		unlink(tmp);
+		goto out;
+	}
+
+	*kept = ix.count;
+	*dropped = total - ix.count;
+	ret = 0;
+
+out:
+	if (map != MAP_FAILED)
+		munmap(map, st.st_size);
+	free(ix.slots);
+	free(tmp);
+	close(fd);
+	return ret;
+}
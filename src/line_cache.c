@@ -0,0 +1,346 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - line_cache.c
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ *
+ * Memoizes the positioned furigana of a subtitle line. Opening and
+ * ending songs, catchphrases and "……" lines repeat across a season, so
+ * the cache is shared by every analyzer of a batch. It is split into
+ * shards, each with its own lock, hash table and LRU list. Once a shard
+ * is full, the entry it evicts is reused for the new line, so a warm
+ * cache only goes to the heap for a line larger than its victim.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "line_cache.h"
+#include "arena.h"
+#include "utils.h"
+
+#define LINE_CACHE_SHARDS	16
+#define LC_ENTRY_ROUND		128
+
+/*
+ * Cache entry - the line text and the readings are stored after the
+ * token array in the same allocation, of @size bytes.
+ */
+struct lc_entry {
+	size_t size;
+	uint64_t hash;
+	struct lc_entry *hnext;		/* hash bucket chain */
+	struct lc_entry *prev;		/* LRU list, most recent first */
+	struct lc_entry *next;
+	int screen_w;
+	float char_width;
+	int ntokens;
+	size_t line_len;
+	struct furigana_token *tokens;
+	char *line;
+};
+
+struct lc_shard {
+	pthread_mutex_t lock;
+	struct lc_entry **buckets;
+	unsigned int nbuckets;		/* power of two */
+	struct lc_entry *head;
+	struct lc_entry *tail;
+	int count;
+	int capacity;
+	long hits;
+	long misses;
+	long evictions;
+};
+
+struct line_cache {
+	struct lc_shard shards[LINE_CACHE_SHARDS];
+};
+
+/*
+ * Only the fields read by calculate_token_positions() affect the result.
+ */
+static uint64_t line_hash(const char *line, size_t len,
+			  const struct font_config *cfg)
+{
+	uint64_t h = hash_bytes(line, len, HASH_SEED);
+
+	h = hash_bytes(&cfg->screen_w, sizeof(cfg->screen_w), h);
+	return hash_bytes(&cfg->char_width, sizeof(cfg->char_width), h);
+}
+
+/*
+ * Create a cache of about @max_entries lines, rounded up to a multiple of
+ * the shard count. Returns NULL if @max_entries is 0 or on failure.
+ */
+struct line_cache *line_cache_new(int max_entries)
+{
+	struct line_cache *c;
+	int per_shard;
+	int i;
+
+	if (max_entries <= 0)
+		return NULL;
+
+	c = calloc(1, sizeof(struct line_cache));
+	if (!c)
+		return NULL;
+
+	per_shard = (max_entries + LINE_CACHE_SHARDS - 1) / LINE_CACHE_SHARDS;
+
+	for (i = 0; i < LINE_CACHE_SHARDS; i++) {
+		struct lc_shard *s = &c->shards[i];
+
+		s->capacity = per_shard;
+		s->nbuckets = 16;
+		while (s->nbuckets < (unsigned int)per_shard)
+			s->nbuckets <<= 1;
+
+		s->buckets = calloc(s->nbuckets, sizeof(struct lc_entry *));
+		if (!s->buckets) {
+			while (i-- > 0)
+				free(c->shards[i].buckets);
+			free(c);
+			return NULL;
+		}
+		pthread_mutex_init(&s->lock, NULL);
+	}
+	return c;
+}
+
+void line_cache_free(struct line_cache *c)
+{
+	int i;
+
+	if (!c)
+		return;
+
+	for (i = 0; i < LINE_CACHE_SHARDS; i++) {
+		struct lc_shard *s = &c->shards[i];
+		struct lc_entry *e = s->head;
+
+		while (e) {
+			struct lc_entry *next = e->next;
+
+			free(e);
+			e = next;
+		}
+		free(s->buckets);
+		pthread_mutex_destroy(&s->lock);
+	}
+	free(c);
+}
+
+static struct lc_shard *shard_for(struct line_cache *c, uint64_t hash)
+{
+	return &c->shards[(hash >> 60) % LINE_CACHE_SHARDS];
+}
+
+static struct lc_entry **bucket_for(struct lc_shard *s, uint64_t hash)
+{
+	return &s->buckets[hash & (s->nbuckets - 1)];
+}
+
+/* Called with the shard locked */
+static struct lc_entry *shard_find(struct lc_shard *s, uint64_t hash,
+				   const char *line, size_t len,
+				   const struct font_config *cfg)
+{
+	struct lc_entry *e;
+
+	for (e = *bucket_for(s, hash); e; e = e->hnext) {
+		if (e->hash == hash && e->line_len == len &&
+		    e->screen_w == cfg->screen_w &&
+		    e->char_width == cfg->char_width &&
+		    memcmp(e->line, line, len) == 0)
+			return e;
+	}
+	return NULL;
+}
+
+static void lru_unlink(struct lc_shard *s, struct lc_entry *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		s->head = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		s->tail = e->prev;
+}
+
+static void lru_push_front(struct lc_shard *s, struct lc_entry *e)
+{
+	e->prev = NULL;
+	e->next = s->head;
+	if (s->head)
+		s->head->prev = e;
+	s->head = e;
+	if (!s->tail)
+		s->tail = e;
+}
+
+/* Take the least recently used entry out of @s, for reuse */
+static struct lc_entry *shard_evict(struct lc_shard *s)
+{
+	struct lc_entry *e = s->tail;
+	struct lc_entry **link;
+
+	for (link = bucket_for(s, e->hash); *link; link = &(*link)->hnext) {
+		if (*link == e) {
+			*link = e->hnext;
+			break;
+		}
+	}
+
+	lru_unlink(s, e);
+	s->count--;
+	s->evictions++;
+	return e;
+}
+
+/*
+ * Look up @line. On a hit, *@tokens receives a private copy of the
+ * cached tokens, allocated from @a. Returns 1 on a hit, 0 on a miss.
+ */
+int line_cache_get(struct line_cache *c, const char *line,
+		   const struct font_config *cfg, struct arena *a,
+		   struct furigana_token **tokens, int *token_count)
+{
+	size_t len = strlen(line);
+	uint64_t hash = line_hash(line, len, cfg);
+	struct lc_shard *s = shard_for(c, hash);
+	struct furigana_token *copy = NULL;
+	struct lc_entry *e;
+	int i;
+
+	pthread_mutex_lock(&s->lock);
+
+	e = shard_find(s, hash, line, len, cfg);
+	if (!e) {
+		s->misses++;
+		pthread_mutex_unlock(&s->lock);
+		return 0;
+	}
+
+	copy = arena_alloc(a, (e->ntokens ? e->ntokens : 1) *
+			      sizeof(struct furigana_token));
+	for (i = 0; copy && i < e->ntokens; i++) {
+		copy[i] = e->tokens[i];
+		copy[i].reading = arena_strndup(a, e->tokens[i].reading,
+						strlen(e->tokens[i].reading));
+		if (!copy[i].reading)
+			copy = NULL;
+	}
+
+	if (!copy) {
+		s->misses++;
+		pthread_mutex_unlock(&s->lock);
+		return 0;
+	}
+
+	lru_unlink(s, e);
+	lru_push_front(s, e);
+	s->hits++;
+	*tokens = copy;
+	*token_count = e->ntokens;
+
+	pthread_mutex_unlock(&s->lock);
+	return 1;
+}
+
+/*
+ * Remember the tokens of @line, in place of the least recently used
+ * entry of its shard when the shard is full.
+ */
+void line_cache_put(struct line_cache *c, const char *line,
+		    const struct font_config *cfg,
+		    const struct furigana_token *tokens, int token_count)
+{
+	size_t len = strlen(line);
+	uint64_t hash = line_hash(line, len, cfg);
+	struct lc_shard *s = shard_for(c, hash);
+	struct lc_entry *e;
+	size_t size;
+	char *p;
+	int i;
+
+	size = sizeof(struct lc_entry) +
+	       token_count * sizeof(struct furigana_token) + len + 1;
+	for (i = 0; i < token_count; i++)
+		size += strlen(tokens[i].reading) + 1;
+
+	/* Rounded up, so most victims are large enough for the next line */
+	size = (size + LC_ENTRY_ROUND - 1) & ~(size_t)(LC_ENTRY_ROUND - 1);
+
+	pthread_mutex_lock(&s->lock);
+
+	/* Another analyzer may have cached the same line meanwhile */
+	if (shard_find(s, hash, line, len, cfg)) {
+		pthread_mutex_unlock(&s->lock);
+		return;
+	}
+
+	e = s->count >= s->capacity ? shard_evict(s) : NULL;
+	if (!e || e->size < size) {
+		struct lc_entry *tmp = realloc(e, size);
+
+		if (!tmp) {
+			free(e);
+			pthread_mutex_unlock(&s->lock);
+			return;
+		}
+		e = tmp;
+		e->size = size;
+	}
+
+	e->hash = hash;
+	e->screen_w = cfg->screen_w;
+	e->char_width = cfg->char_width;
+	e->ntokens = token_count;
+	e->line_len = len;
+	e->tokens = (struct furigana_token *)(e + 1);
+	p = (char *)(e->tokens + token_count);
+
+	e->line = p;
+	memcpy(p, line, len + 1);
+	p += len + 1;
+
+	for (i = 0; i < token_count; i++) {
+		size_t rlen = strlen(tokens[i].reading) + 1;
+
+		e->tokens[i] = tokens[i];
+		e->tokens[i].reading = p;
+		memcpy(p, tokens[i].reading, rlen);
+		p += rlen;
+	}
+
+	e->hnext = *bucket_for(s, hash);
+	*bucket_for(s, hash) = e;
+	lru_push_front(s, e);
+	s->count++;
+
+	pthread_mutex_unlock(&s->lock);
+}
+
+void line_cache_get_stats(struct line_cache *c, struct line_cache_stats *st)
+{
+	int i;
+
+	memset(st, 0, sizeof(*st));
+
+	for (i = 0; i < LINE_CACHE_SHARDS; i++) {
+		struct lc_shard *s = &c->shards[i];
+
+		pthread_mutex_lock(&s->lock);
+		st->hits += s->hits;
+		st->misses += s->misses;
+		st->evictions += s->evictions;
+		st->entries += s->count;
+		pthread_mutex_unlock(&s->lock);
+	}
+}
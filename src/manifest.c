@@ -0,0 +1,279 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - manifest.c
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ *
+ * Records, for each output of an incremental run, the source it came
+ * from, the settings and the tool version. The manifest is a text file,
+ * one tab-separated entry per line with the source path last.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "manifest.h"
+#include "types.h"
+#include "utils.h"
+
+#define MANIFEST_MAGIC	"# furigana4subtitles manifest 1\n"
+#define MANIFEST_FIELDS	11
+
+static size_t path_slot(const struct manifest *m, const char *path)
+{
+	return hash_bytes(path, strlen(path), HASH_SEED) & (m->nindex - 1);
+}
+
+static int manifest_reindex(struct manifest *m, int nindex)
+{
+	int *index;
+	int i;
+
+	index = malloc(nindex * sizeof(int));
+	if (!index)
+		return -1;
+
+	free(m->index);
+	m->index = index;
+	m->nindex = nindex;
+
+	for (i = 0; i < nindex; i++)
+		m->index[i] = -1;
+
+	for (i = 0; i < m->count; i++) {
+		size_t s;
+
+		if (!m->entries[i].path)
+			continue;
+
+		s = path_slot(m, m->entries[i].path);
+
+		while (m->index[s] >= 0)
+			s = (s + 1) & (nindex - 1);
+		m->index[s] = i;
+	}
+	return 0;
+}
+
+/* Removed entries keep their slot with a NULL path */
+static int find_index(const struct manifest *m, const char *path)
+{
+	size_t s;
+
+	if (!m->nindex)
+		return -1;
+
+	for (s = path_slot(m, path); m->index[s] >= 0;
+	     s = (s + 1) & (m->nindex - 1)) {
+		const char *p = m->entries[m->index[s]].path;
+
+		if (p && strcmp(p, path) == 0)
+			return m->index[s];
+	}
+	return -1;
+}
+
+const struct manifest_entry *manifest_find(const struct manifest *m,
+					   const char *path)
+{
+	int i = find_index(m, path);
+
+	return i < 0 ? NULL : &m->entries[i];
+}
+
+/*
+ * Add @e, or replace the entry with the same path. The path is copied.
+ */
+int manifest_set(struct manifest *m, const struct manifest_entry *e)
+{
+	struct manifest_entry *tmp;
+	char *path;
+	size_t s;
+	int i;
+
+	path = strdup(e->path);
+	if (!path)
+		return -1;
+
+	i = find_index(m, e->path);
+	if (i >= 0) {
+		free(m->entries[i].path);
+		m->entries[i] = *e;
+		m->entries[i].path = path;
+		return 0;
+	}
+
+	if (m->count >= m->capacity) {
+		int capacity = m->capacity ? m->capacity * 2 : 64;
+
+		tmp = realloc(m->entries, capacity * sizeof(*tmp));
+		if (!tmp)
+			goto fail;
+		m->entries = tmp;
+		m->capacity = capacity;
+	}
+
+	if ((m->count + 1) * 2 > m->nindex &&
+	    manifest_reindex(m, m->nindex ? m->nindex * 2 : 128) < 0)
+		goto fail;
+
+	m->entries[m->count] = *e;
+	m->entries[m->count].path = path;
+
+	for (s = path_slot(m, path); m->index[s] >= 0;
+	     s = (s + 1) & (m->nindex - 1))
+		;
+	m->index[s] = m->count++;
+	return 0;
+
+fail:
+	free(path);
+	return -1;
+}
+
+void manifest_remove(struct manifest *m, const char *path)
+{
+	int i = find_index(m, path);
+
+	if (i < 0)
+		return;
+	free(m->entries[i].path);
+	m->entries[i].path = NULL;
+}
+
+static int parse_entry(char *line, struct manifest_entry *e)
+{
+	char *field[MANIFEST_FIELDS];
+	char *save = NULL;
+	int i;
+
+	/* The path is last and may contain anything but a tab */
+	for (i = 0; i < MANIFEST_FIELDS - 1; i++) {
+		field[i] = strtok_r(i ? NULL : line, "\t", &save);
+		if (!field[i])
+			return -1;
+	}
+	field[i] = strtok_r(NULL, "\n", &save);
+	if (!field[i] || strlen(field[0]) >= sizeof(e->version))
+		return -1;
+
+	strcpy(e->version, field[0]);
+	e->cfg_hash = strtoull(field[1], NULL, 16);
+	e->size = strtoll(field[2], NULL, 10);
+	e->mtime.tv_sec = strtoll(field[3], NULL, 10);
+	e->mtime.tv_nsec = strtol(field[4], NULL, 10);
+	e->src_hash = strtoull(field[5], NULL, 16);
+	e->count = atoi(field[6]);
+	e->out_size = strtoll(field[7], NULL, 10);
+	e->out_mtime.tv_sec = strtoll(field[8], NULL, 10);
+	e->out_mtime.tv_nsec = strtol(field[9], NULL, 10);
+	e->path = field[10];
+	return 0;
+}
+
+/*
+ * Load the manifest at @path. A missing manifest is an empty one;
+ * malformed lines are ignored, as their outputs are simply rebuilt.
+ * Returns -1 on failure.
+ */
+int manifest_load(struct manifest *m, const char *path)
+{
+	char *line = NULL;
+	size_t cap = 0;
+	FILE *f;
+	int ret = 0;
+
+	memset(m, 0, sizeof(*m));
+
+	f = fopen(path, "r");
+	if (!f)
+		return errno == ENOENT ? 0 : -1;
+
+	if (getline(&line, &cap, f) < 0 || strcmp(line, MANIFEST_MAGIC) != 0) {
+		fprintf(stderr, "Ignoring manifest %s: unknown format\n", path);
+		goto out;
+	}
+
+	while (getline(&line, &cap, f) >= 0) {
+		struct manifest_entry e;
+
+		if (parse_entry(line, &e) == 0 && manifest_set(m, &e) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+
+out:
+	free(line);
+	fclose(f);
+	return ret;
+}
+
+/*
+ * Write the manifest next to @path and rename it into place, so an
+ * interrupted run leaves the previous manifest intact.
+ */
+int manifest_save(const struct manifest *m, const char *path)
+{
+	size_t len = strlen(path);
+	int ret = -1;
+	char *tmp;
+	FILE *f;
+	int i;
+
+	tmp = malloc(len + sizeof(".tmp"));
+	if (!tmp)
+		return -1;
+	memcpy(tmp, path, len);
+	strcpy(tmp + len, ".tmp");
+
+	f = fopen(tmp, "w");
+	if (!f)
+		goto out;
+
+	fputs(MANIFEST_MAGIC, f);
+
+	for (i = 0; i < m->count; i++) {
+		const struct manifest_entry *e = &m->entries[i];
+
+		if (!e->path || strpbrk(e->path, "\t\n"))
+			continue;
+
+		fprintf(f, "%s\t%016llx\t%lld\t%lld\t%ld\t%016llx\t%d\t"
+			   "%lld\t%lld\t%ld\t%s\n",
+			e->version, (unsigned long long)e->cfg_hash, e->size,
+			(long long)e->mtime.tv_sec, (long)e->mtime.tv_nsec,
+			(unsigned long long)e->src_hash, e->count, e->out_size,
+			(long long)e->out_mtime.tv_sec,
+			(long)e->out_mtime.tv_nsec, e->path);
+	}
+
+	if (fflush(f) != 0 || ferror(f)) {
+		fclose(f);
+		unlink(tmp);
+		goto out;
+	}
+	if (fclose(f) != 0 || rename(tmp, path) < 0) {
+		unlink(tmp);
+		goto out;
+	}
+	ret = 0;
+out:
+	free(tmp);
+	return ret;
+}
+
+void manifest_free(struct manifest *m)
+{
+	int i;
+
+	for (i = 0; i < m->count; i++)
+		free(m->entries[i].path);
+	free(m->entries);
+	free(m->index);
+	memset(m, 0, sizeof(*m));
+}
@@ -9,161 +9,152 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <wchar.h>
 
 #include "mecab_helpers.h"
 #include "utils.h"
+#include "utf8.h"
+#include "stats.h"
+#include "mem.h"
 
-char *extract_mecab_field(const char *feature, int index)
-{
-	char *copy, *tok, *res;
-	int i;
-
-	if (!feature)
-		return NULL;
+/*
+ * Reading field of the feature string in each supported dictionary
+ */
+static const struct {
+	const char *name;
+	int field;
+} dict_layouts[] = {
+	{ "ipadic", MECAB_READING_FIELD },
+	{ "unidic", UNIDIC_READING_FIELD },
+};
 
-	copy = strdup(feature);
-	if (!copy)
-		return NULL;
+/*
+ * Parse a --reading-field value: a dictionary name or a field index.
+ * Returns the field index, or -1 if @arg is neither.
+ */
+int parse_reading_field(const char *arg)
+{
+	char *end;
+	size_t i;
+	long n;
 
-	tok = strtok(copy, ",");
-	for (i = 0; i < index && tok; i++)
-		tok = strtok(NULL, ",");
+	for (i = 0; i < sizeof(dict_layouts) / sizeof(dict_layouts[0]); i++) {
+		if (strcmp(arg, dict_layouts[i].name) == 0)
+			return dict_layouts[i].field;
+	}
 
-	res = tok ? strdup(tok) : NULL;
-	free(copy);
-	return res;
+	n = strtol(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || n < 0 || n > 63)
+		return -1;
+	return (int)n;
 }
 
-char *katakana_to_hiragana(const char *in)
+/*
+ * Find field @index of a MeCab feature string without copying it.
+ * Quoted fields may contain commas; the quotes are not part of the span.
+ * Returns the start of the field and its length in *@len, or NULL if
+ * the feature has fewer fields.
+ */
+const char *mecab_field_span(const char *feature, int index, size_t *len)
 {
-	wchar_t *wbuf;
-	char *out;
-	size_t len, i;
-
-	if (!in)
-		return NULL;
+	const char *p = feature;
+	int i;
 
-	len = strlen(in);
-	wbuf = malloc((len + 1) * sizeof(wchar_t));
-	if (!wbuf)
+	if (!p)
 		return NULL;
 
-	if (mbstowcs(wbuf, in, len + 1) == (size_t)-1) {
-		free(wbuf);
-		return NULL;
-	}
+	for (i = 0; ; i++) {
+		const char *start, *end;
+
+		if (*p == '"') {
+			start = ++p;
+			while (*p && (*p != '"' || p[1] == '"'))
+				p += *p == '"' ? 2 : 1;
+			end = p;
+			if (*p)
+				p++;
+			p += strcspn(p, ",");
+		} else {
+			start = p;
+			p += strcspn(p, ",");
+			end = p;
+		}
 
-	/* Convert katakana (0x30A1-0x30FA) to hiragana by subtracting 0x60 */
-	for (i = 0; wbuf[i]; i++) {
-		if (wbuf[i] >= 0x30A1 && wbuf[i] <= 0x30FA)
-			wbuf[i] -= 0x60;
+		if (i == index) {
+			*len = (size_t)(end - start);
+			return start;
+		}
+		if (!*p)
+			return NULL;
+		p++;
 	}
+}
 
-	out = malloc(len * 4 + 1);
-	if (!out) {
-		free(wbuf);
-		return NULL;
-	}
+/*
+ * Copy the @len bytes at @in to @a as hiragana.
+ */
+char *katakana_to_hiragana(struct arena *a, const char *in, size_t len)
+{
+	char *out;
 
-	if (wcstombs(out, wbuf, len * 4 + 1) == (size_t)-1) {
-		free(wbuf);
-		free(out);
+	if (!in)
 		return NULL;
-	}
 
-	free(wbuf);
+	out = arena_strndup(a, in, len);
+	if (out)
+		utf8_katakana_to_hiragana(out, len);
 	return out;
 }
 
-static int is_hiragana(wchar_t c)
-{
-	return (c >= 0x3040 && c <= 0x309F);
-}
-
 /*
  * Extract kanji-only reading by stripping matching hiragana
  * from the beginning and end of the surface form.
  */
-static char *extract_kanji_reading(const char *surface, const char *full_reading)
+static char *extract_kanji_reading(struct arena *a, const char *surface,
+				   const char *full_reading)
 {
-	wchar_t *wsurf = NULL;
-	wchar_t *wread = NULL;
-	wchar_t *wresult = NULL;
-	char *result = NULL;
-	size_t surf_len, read_len;
-	size_t wsurf_len, wread_len;
-	size_t prefix_skip, suffix_skip;
-	size_t start, end, new_len;
+	size_t surf_start, surf_end, read_start, read_end;
+	uint32_t sc, rc;
+	size_t n, m;
 
 	if (!surface || !full_reading)
 		return NULL;
 
-	surf_len = strlen(surface);
-	read_len = strlen(full_reading);
-
-	wsurf = malloc((surf_len + 1) * sizeof(wchar_t));
-	wread = malloc((read_len + 1) * sizeof(wchar_t));
-	if (!wsurf || !wread)
-		goto out_free;
-
-	if (mbstowcs(wsurf, surface, surf_len + 1) == (size_t)-1)
-		goto out_free;
-	if (mbstowcs(wread, full_reading, read_len + 1) == (size_t)-1)
-		goto out_free;
-
-	wsurf_len = wcslen(wsurf);
-	wread_len = wcslen(wread);
+	surf_start = read_start = 0;
+	surf_end = strlen(surface);
+	read_end = strlen(full_reading);
 
 	/* Strip matching hiragana from the beginning */
-	prefix_skip = 0;
-	while (prefix_skip < wsurf_len && prefix_skip < wread_len &&
-	       is_hiragana(wsurf[prefix_skip]) &&
-	       wsurf[prefix_skip] == wread[prefix_skip]) {
-		prefix_skip++;
+	for (;;) {
+		n = utf8_decode(surface + surf_start, surf_end - surf_start,
+				&sc);
+		m = utf8_decode(full_reading + read_start,
+				read_end - read_start, &rc);
+		if (!n || !m || !utf8_is_hiragana(sc) || sc != rc)
+			break;
+		surf_start += n;
+		read_start += m;
 	}
 
 	/* Strip matching hiragana from the end */
-	suffix_skip = 0;
-	while (suffix_skip < (wsurf_len - prefix_skip) &&
-	       suffix_skip < (wread_len - prefix_skip) &&
-	       is_hiragana(wsurf[wsurf_len - 1 - suffix_skip]) &&
-	       wsurf[wsurf_len - 1 - suffix_skip] ==
-	       wread[wread_len - 1 - suffix_skip]) {
-		suffix_skip++;
+	for (;;) {
+		n = utf8_decode_last(surface + surf_start,
+				     surf_end - surf_start, &sc);
+		m = utf8_decode_last(full_reading + read_start,
+				     read_end - read_start, &rc);
+		if (!n || !m || !utf8_is_hiragana(sc) || sc != rc)
+			break;
+		surf_end -= n;
+		read_end -= m;
 	}
 
 	/* Extract the middle part (corresponds to kanji reading) */
-	start = prefix_skip;
-	end = wread_len - suffix_skip;
-	if (start >= end) {
+	if (read_start >= read_end) {
 		/* Fallback to full reading */
-		result = strdup(full_reading);
-		goto out_free;
+		return (char *)full_reading;
 	}
 
-	new_len = end - start;
-	wresult = malloc((new_len + 1) * sizeof(wchar_t));
-	if (!wresult)
-		goto out_free;
-
-	wcsncpy(wresult, wread + start, new_len);
-	wresult[new_len] = L'\0';
-
-	result = malloc(new_len * 4 + 1);
-	if (!result)
-		goto out_free;
-
-	if (wcstombs(result, wresult, new_len * 4 + 1) == (size_t)-1) {
-		free(result);
-		result = NULL;
-	}
-
-out_free:
-	free(wsurf);
-	free(wread);
-	free(wresult);
-	return result;
+	return arena_strndup(a, full_reading + read_start,
+			     read_end - read_start);
 }
 
 /*
@@ -171,7 +162,7 @@ out_free:
  */
 static void find_kanji_span(const char *surface, int *kanji_start, int *kanji_len)
 {
-	mbstate_t st = {0};
+	size_t len = strlen(surface);
 	int char_idx = 0;
 	int first_kanji = -1;
 	int last_kanji = -1;
@@ -180,14 +171,14 @@ static void find_kanji_span(const char *surface, int *kanji_start, int *kanji_le
 	*kanji_start = -1;
 	*kanji_len = 0;
 
-	for (i = 0; i < strlen(surface); ) {
-		wchar_t wc;
-		size_t n = mbrtowc(&wc, surface + i, strlen(surface) - i, &st);
+	for (i = 0; i < len; ) {
+		uint32_t c;
+		size_t n = utf8_decode(surface + i, len - i, &c);
 
-		if (n == 0 || n == (size_t)-1 || n == (size_t)-2)
+		if (n == 0)
 			break;
 
-		if (is_kanji(wc)) {
+		if (utf8_is_kanji(c)) {
 			if (first_kanji < 0)
 				first_kanji = char_idx;
 			last_kanji = char_idx;
@@ -203,119 +194,251 @@ static void find_kanji_span(const char *surface, int *kanji_start, int *kanji_le
 }
 
 /*
- * Count unicode characters from start of string up to byte_offset.
+ * Work out the furigana of a node: the kanji span of @surface and the
+ * hiragana reading of that span, in *@out, or NULL if the node gets
+ * none. Returns -1 if the reading could not be allocated.
+ */
+static int node_reading(struct arena *a, const char *surface,
+			const char *feature, int field, int *kanji_start,
+			int *kanji_len, char **out)
+{
+	const char *reading;
+	char *hiragana;
+	size_t len;
+
+	*out = NULL;
+	find_kanji_span(surface, kanji_start, kanji_len);
+	if (*kanji_len == 0)
+		return 0;
+
+	reading = mecab_field_span(feature, field, &len);
+	if (!reading || len == 0 || (len == 1 && *reading == '*'))
+		return 0;
+
+	hiragana = katakana_to_hiragana(a, reading, len);
+	if (hiragana)
+		*out = extract_kanji_reading(a, surface, hiragana);
+	return *out ? 0 : -1;
+}
+
+/*
+ * Reading cache - the furigana of recently seen nodes. Feature strings
+ * live in the mapped dictionary, so a node is identified by its feature
+ * pointer and its surface. The table is direct-mapped: a new node simply
+ * replaces whatever was in its slot. Nodes with a longer surface or
+ * reading than an entry holds are not cached.
+ */
+struct rc_entry {
+	const char *feature;	/* NULL for an empty slot */
+	int kanji_start;
+	int kanji_len;
+	char surface[READING_CACHE_TEXT];
+	char reading[READING_CACHE_TEXT];	/* empty if no furigana */
+};
+
+struct reading_cache {
+	struct rc_entry slots[READING_CACHE_SLOTS];
+};
+
+/*
+ * Find the furigana of the node with @feature and @surface, working it
+ * out on a miss. Sets *@out to the reading, allocated from the arena of
+ * @an, or to NULL if the node gets none. Returns -1 if the reading could
+ * not be allocated; nothing is cached then, as the node may well have a
+ * reading.
+ */
+static int lookup_reading(struct analyzer *an, const char *feature,
+			  const char *surface, size_t len, int *kanji_start,
+			  int *kanji_len, char **out)
+{
+	struct rc_entry *e;
+	char *reading;
+	uint64_t h;
+
+	h = hash_bytes(&feature, sizeof(feature), HASH_SEED);
+	h = hash_bytes(surface, len, h);
+	e = &an->readings->slots[h & (READING_CACHE_SLOTS - 1)];
+
+	if (e->feature == feature && strcmp(e->surface, surface) == 0) {
+		*out = NULL;
+		if (!e->reading[0])
+			return 0;
+		*kanji_start = e->kanji_start;
+		*kanji_len = e->kanji_len;
+		*out = arena_strndup(&an->arena, e->reading,
+				     strlen(e->reading));
+		return *out ? 0 : -1;
+	}
+
+	if (node_reading(&an->arena, surface, feature, an->reading_field,
+			 kanji_start, kanji_len, out) < 0)
+		return -1;
+	reading = *out;
+
+	if (len < sizeof(e->surface) &&
+	    (!reading || strlen(reading) < sizeof(e->reading))) {
+		e->feature = feature;
+		e->kanji_start = *kanji_start;
+		e->kanji_len = *kanji_len;
+		memcpy(e->surface, surface, len + 1);
+		strcpy(e->reading, reading ? reading : "");
+	}
+	return 0;
+}
+
+/*
+ * Load the dictionary once; every analyzer shares the returned model.
  */
-static int count_chars_to_offset(const char *str, size_t byte_offset)
+mecab_model_t *load_mecab_model(void)
 {
-	mbstate_t st = {0};
-	int count = 0;
-	size_t i = 0;
+	mecab_model_t *model = mecab_model_new2("");
 
-	while (i < byte_offset && str[i]) {
-		wchar_t wc;
-		size_t n = mbrtowc(&wc, str + i, byte_offset - i, &st);
+	if (!model)
+		fprintf(stderr, "MeCab initialization failed\n");
+	return model;
+}
 
-		if (n == 0 || n == (size_t)-1 || n == (size_t)-2)
-			break;
-		count++;
-		i += n;
+/*
+ * Identify the dictionaries of @model and how readings are taken from
+ * them, so cached readings are not reused with a different dictionary.
+ */
+uint64_t dictionary_fingerprint(mecab_model_t *model, int field)
+{
+	const mecab_dictionary_info_t *d;
+	uint64_t h = HASH_SEED;
+
+	for (d = mecab_model_dictionary_info(model); d; d = d->next) {
+		h = hash_bytes(d->filename, strlen(d->filename) + 1, h);
+		h = hash_bytes(d->charset, strlen(d->charset) + 1, h);
+		h = hash_bytes(&d->size, sizeof(d->size), h);
+		h = hash_bytes(&d->type, sizeof(d->type), h);
+		h = hash_bytes(&d->version, sizeof(d->version), h);
+	}
+	return hash_bytes(&field, sizeof(field), h);
+}
+
+int analyzer_init(struct analyzer *an, mecab_model_t *model,
+		  int reading_field)
+{
+	an->reading_field = reading_field;
+	an->cache = NULL;
+	an->disk = NULL;
+	an->stats = NULL;
+	an->tagger = mecab_model_new_tagger(model);
+	an->lattice = mecab_model_new_lattice(model);
+	an->readings = mem_calloc(1, sizeof(struct reading_cache));
+	arena_init(&an->arena);
+	if (!an->tagger || !an->lattice || !an->readings) {
+		analyzer_destroy(an);
+		return -1;
 	}
-	return count;
+	return 0;
+}
+
+void analyzer_destroy(struct analyzer *an)
+{
+	if (an->lattice)
+		mecab_lattice_destroy(an->lattice);
+	if (an->tagger)
+		mecab_destroy(an->tagger);
+	mem_free(an->readings);
+	arena_free(&an->arena);
+	an->lattice = NULL;
+	an->tagger = NULL;
+	an->readings = NULL;
 }
 
-struct furigana_token *analyze_text_with_mecab(mecab_t *mecab, const char *line,
+/*
+ * Analyze @line. The tokens and their readings are allocated from the
+ * arena of @an and stay valid until it is reset. Returns NULL if MeCab
+ * fails or memory runs out, which is not the same as a line without
+ * furigana: that one gets tokens, none of them.
+ */
+struct furigana_token *analyze_text_with_mecab(struct analyzer *an,
+					       const char *line,
 					       int *token_count)
 {
 	const mecab_node_t *node;
 	struct furigana_token *tokens;
-	int capacity = INITIAL_TOKEN_CAPACITY;
+	size_t prev_offset = 0;
+	double start = 0.0, parsed = 0.0;
+	long nodes = 0;
+	int char_pos = 0;
 
 	*token_count = 0;
 
-	node = mecab_sparse_tonode(mecab, line);
+	if (an->stats)
+		start = monotonic_seconds();
+
+	mecab_lattice_set_sentence(an->lattice, line);
+	if (!mecab_parse_lattice(an->tagger, an->lattice))
+		return NULL;
+
+	if (an->stats) {
+		parsed = monotonic_seconds();
+		an->stats->seconds[STATS_MECAB] += parsed - start;
+	}
+
+	node = mecab_lattice_get_bos_node(an->lattice);
 	if (!node)
 		return NULL;
 
-	tokens = malloc(capacity * sizeof(struct furigana_token));
+	/* Every token covers at least one kanji, three bytes in UTF-8 */
+	tokens = arena_alloc(&an->arena, (strlen(line) / 3 + 1) *
+				       sizeof(struct furigana_token));
 	if (!tokens)
 		return NULL;
 
+	/* Nodes come in order, so count characters from the previous one */
 	for (; node; node = node->next) {
 		char surface[256] = {0};
-		char *reading, *hiragana, *kanji_reading;
+		char *reading;
 		size_t copy_len, byte_offset;
-		int surface_chars, char_pos;
+		int surface_chars;
 		int kanji_start, kanji_len;
 
 		if (node->stat != MECAB_NOR_NODE && node->stat != MECAB_UNK_NODE)
 			continue;
+		nodes++;
 
 		copy_len = node->length < 255 ? node->length : 255;
 		strncpy(surface, node->surface, copy_len);
 		surface[copy_len] = '\0';
 
-		surface_chars = count_unicode_chars(surface);
+		surface_chars = utf8_count(surface, copy_len);
 		if (surface_chars == 0)
 			continue;
 
-		/* Calculate character position from byte offset */
 		byte_offset = (size_t)(node->surface - line);
-		char_pos = count_chars_to_offset(line, byte_offset);
-
-		find_kanji_span(surface, &kanji_start, &kanji_len);
-		if (kanji_len == 0)
-			continue;
-
-		reading = extract_mecab_field(node->feature, MECAB_READING_FIELD);
-		if (!reading || strcmp(reading, "*") == 0) {
-			free(reading);
-			continue;
-		}
-
-		hiragana = katakana_to_hiragana(reading);
-		free(reading);
-		if (!hiragana)
+		char_pos += utf8_count(line + prev_offset,
+				       byte_offset - prev_offset);
+		prev_offset = byte_offset;
+
+		if (lookup_reading(an, node->feature, surface, copy_len,
+				   &kanji_start, &kanji_len, &reading) < 0)
+			return NULL;
+		if (!reading)
 			continue;
 
-		kanji_reading = extract_kanji_reading(surface, hiragana);
-		free(hiragana);
-		if (!kanji_reading)
-			continue;
-
-		/* Grow array if needed */
-		if (*token_count >= capacity) {
-			struct furigana_token *tmp;
-
-			capacity *= 2;
-			tmp = realloc(tokens,
-				      capacity * sizeof(struct furigana_token));
-			if (!tmp) {
-				int j;
-
-				for (j = 0; j < *token_count; j++)
-					free(tokens[j].reading);
-				free(tokens);
-				free(kanji_reading);
-				*token_count = 0;
-				return NULL;
-			}
-			tokens = tmp;
-		}
-
-		tokens[*token_count].reading = kanji_reading;
+		tokens[*token_count].reading = reading;
 		tokens[*token_count].start_char = char_pos + kanji_start;
 		tokens[*token_count].char_len = kanji_len;
 		tokens[*token_count].x = 0.0f;
 		(*token_count)++;
 	}
 
+	if (an->stats) {
+		an->stats->seconds[STATS_READINGS] +=
+			monotonic_seconds() - parsed;
+		an->stats->nodes += nodes;
+	}
 	return tokens;
 }
 
 void calculate_token_positions(const char *line, struct furigana_token *tokens,
 			       int token_count, struct font_config *cfg)
 {
-	int total_chars = count_unicode_chars(line);
+	int total_chars = utf8_count(line, strlen(line));
 	float start_x = (cfg->screen_w - total_chars * cfg->char_width) / 2.0f;
 	int i;
 
@@ -0,0 +1,278 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - mem.c
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ *
+ * Heap allocations of the conversion path, with optional accounting.
+ * Until mem_enable() is called, the wrappers are plain malloc() and
+ * free(). Once it is, every block starts with a header recording its
+ * size and the account it was charged to, the account of the calling
+ * thread at the time, so it is credited back whichever thread frees it.
+ * Memory that is freed must then have come from these wrappers, which
+ * is why they are only enabled before anything is allocated.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "mem.h"
+
+/* Keeps the data after it aligned as malloc() would */
+union mem_header {
+	struct {
+		size_t size;
+		struct mem_account *account;
+	} h;
+	long double align;
+	void *ptr;
+};
+
+static int enabled;
+static pthread_key_t current;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Turn accounting on. Must be called before any thread starts and
+ * before anything is allocated with the wrappers.
+ */
+int mem_enable(void)
+{
+	if (pthread_key_create(&current, NULL) != 0)
+		return -1;
+	enabled = 1;
+	return 0;
+}
+
+/*
+ * Charge what the calling thread allocates from now on to @a, or to no
+ * account if @a is NULL. Returns the previous account.
+ */
+struct mem_account *mem_set_account(struct mem_account *a)
+{
+	struct mem_account *prev;
+
+	if (!enabled)
+		return NULL;
+	prev = pthread_getspecific(current);
+	pthread_setspecific(current, a);
+	return prev;
+}
+
+/* The account the calling thread charges, or NULL for none */
+struct mem_account *mem_current(void)
+{
+	if (!enabled)
+		return NULL;
+	return pthread_getspecific(current);
+}
+
+/*
+ * Charge @delta bytes, which may be negative, to @a and its parents,
+ * counting @alloc allocations: 1 for a new one, -1 to take back one
+ * that failed. Growth that would take any account over its budget is
+ * refused. Called with the lock held.
+ */
+static int charge(struct mem_account *a, long long delta, int alloc)
+{
+	struct mem_account *it;
+
+	for (it = a; delta > 0 && it; it = it->parent) {
+		if (it->budget && it->live + delta > it->budget) {
+			for (it = a; it; it = it->parent)
+				it->refused++;
+			return -1;
+		}
+	}
+
+	for (it = a; it; it = it->parent) {
+		it->live += delta;
+		if (it->live > it->peak)
+			it->peak = it->live;
+		if (alloc) {
+			it->allocs += alloc;
+			it->bytes += delta;
+		}
+	}
+	return 0;
+}
+
+void *mem_malloc(size_t size)
+{
+	struct mem_account *a;
+	union mem_header *hdr;
+
+	if (!enabled)
+		return malloc(size);
+
+	if (size > (size_t)-1 - sizeof(*hdr)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	a = pthread_getspecific(current);
+	if (a) {
+		pthread_mutex_lock(&lock);
+		if (charge(a, size, 1) < 0) {
+			pthread_mutex_unlock(&lock);
+			errno = ENOMEM;
+			return NULL;
+		}
+		pthread_mutex_unlock(&lock);
+	}
+
+	hdr = malloc(sizeof(*hdr) + size);
+	if (!hdr) {
+		if (a) {
+			pthread_mutex_lock(&lock);
+			charge(a, -(long long)size, -1);
+			pthread_mutex_unlock(&lock);
+		}
+		return NULL;
+	}
+
+	hdr->h.size = size;
+	hdr->h.account = a;
+	return hdr + 1;
+}
+
+void *mem_calloc(size_t n, size_t size)
+{
+	void *p;
+
+	if (!enabled)
+		return calloc(n, size);
+
+	if (size && n > (size_t)-1 / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	p = mem_malloc(n * size);
+	if (p)
+		memset(p, 0, n * size);
+	return p;
+}
+
+/*
+ * Resize @ptr, charging the difference to the account it was first
+ * charged to.
+ */
+void *mem_realloc(void *ptr, size_t size)
+{
+	union mem_header *hdr, *tmp;
+	struct mem_account *a;
+	long long delta;
+
+	if (!enabled)
+		return realloc(ptr, size);
+	if (!ptr)
+		return mem_malloc(size);
+
+	if (size > (size_t)-1 - sizeof(*hdr)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	hdr = (union mem_header *)ptr - 1;
+	a = hdr->h.account;
+	delta = (long long)size - (long long)hdr->h.size;
+
+	if (a) {
+		pthread_mutex_lock(&lock);
+		if (charge(a, delta, delta > 0) < 0) {
+			pthread_mutex_unlock(&lock);
+			errno = ENOMEM;
+			return NULL;
+		}
+		pthread_mutex_unlock(&lock);
+	}
+
+	tmp = realloc(hdr, sizeof(*hdr) + size);
+	if (!tmp) {
+		if (a) {
+			pthread_mutex_lock(&lock);
+			charge(a, -delta, delta > 0 ? -1 : 0);
+			pthread_mutex_unlock(&lock);
+		}
+		return NULL;
+	}
+
+	tmp->h.size = size;
+	return tmp + 1;
+}
+
+/*
+ * Charge @delta bytes, which may be negative, of memory held on behalf
+ * of @a but allocated elsewhere, such as arena space. It counts towards
+ * the live bytes, peak and budget of @a, not its allocations. Returns
+ * -1 if it would take an account over its budget.
+ */
+int mem_charge(struct mem_account *a, long long delta)
+{
+	int ret;
+
+	if (!enabled || !a || !delta)
+		return 0;
+
+	pthread_mutex_lock(&lock);
+	ret = charge(a, delta, 0);
+	pthread_mutex_unlock(&lock);
+	if (ret < 0)
+		errno = ENOMEM;
+	return ret;
+}
+
+void mem_free(void *ptr)
+{
+	union mem_header *hdr;
+
+	if (!enabled || !ptr) {
+		free(ptr);
+		return;
+	}
+
+	hdr = (union mem_header *)ptr - 1;
+	if (hdr->h.account) {
+		pthread_mutex_lock(&lock);
+		charge(hdr->h.account, -(long long)hdr->h.size, 0);
+		pthread_mutex_unlock(&lock);
+	}
+	free(hdr);
+}
+
+/*
+ * Add the counts of @from to @to. Peaks are not added up: @to keeps
+ * the highest.
+ */
+void mem_add(struct mem_account *to, const struct mem_account *from)
+{
+	to->allocs += from->allocs;
+	to->bytes += from->bytes;
+	to->live += from->live;
+	to->refused += from->refused;
+	if (from->peak > to->peak)
+		to->peak = from->peak;
+}
+
+static void print_size(FILE *f, long long n)
+{
+	if (n < 1024)
+		fprintf(f, "%lld B", n);
+	else if (n < 1024 * 1024)
+		fprintf(f, "%.1f KB", n / 1024.0);
+	else
+		fprintf(f, "%.1f MB", n / (1024.0 * 1024.0));
+}
+
+/* Print the counts of @a after @name, if not empty, on a single line */
+void mem_print(FILE *f, const char *name, const struct mem_account *a)
+{
+	fprintf(f, "%s%s%ld allocs, ", name, *name ? " " : "", a->allocs);
+	print_size(f, a->bytes);
+	fputs(", peak ", f);
+	print_size(f, a->peak);
+}
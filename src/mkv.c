@@ -0,0 +1,847 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - mkv.c
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ *
+ * Reads the SRT track of a Matroska file without reading its video.
+ * Only element headers are read on the way to the track list and the
+ * index: the SeekHead points at them, or the top-level elements are
+ * stepped over by size. When the index (Cues) covers the subtitle
+ * track, as mkvmerge writes it, each subtitle block is read on its own
+ * at its cluster offset. Otherwise every cluster is scanned once, still
+ * reading only block headers and the subtitle payloads.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "mkv.h"
+#include "srt.h"
+#include "types.h"
+#include "mem.h"
+
+/* EBML element IDs, with their length marker */
+#define ID_SEGMENT		0x18538067
+#define ID_SEEKHEAD		0x114D9B74
+#define ID_SEEK			0x4DBB
+#define ID_SEEKID		0x53AB
+#define ID_SEEKPOSITION		0x53AC
+#define ID_INFO			0x1549A966
+#define ID_TIMESTAMPSCALE	0x2AD7B1
+#define ID_TRACKS		0x1654AE6B
+#define ID_TRACKENTRY		0xAE
+#define ID_TRACKNUMBER		0xD7
+#define ID_CODECID		0x86
+#define ID_LANGUAGE		0x22B59C
+#define ID_LANGUAGEBCP47	0x22B59D
+#define ID_CONTENTENCODINGS	0x6D80
+#define ID_CUES			0x1C53BB6B
+#define ID_CUEPOINT		0xBB
+#define ID_CUETRACKPOSITIONS	0xB7
+#define ID_CUETRACK		0xF7
+#define ID_CUECLUSTERPOSITION	0xF1
+#define ID_CUERELATIVEPOSITION	0xF0
+#define ID_CLUSTER		0x1F43B675
+#define ID_TIMESTAMP		0xE7
+#define ID_SIMPLEBLOCK		0xA3
+#define ID_BLOCKGROUP		0xA0
+#define ID_BLOCK		0xA1
+#define ID_BLOCKDURATION	0x9B
+#define ID_TAGS			0x1254C367
+#define ID_CHAPTERS		0x1043A770
+#define ID_ATTACHMENTS		0x1941A469
+
+#define SRT_CODEC		"S_TEXT/UTF8"
+#define DEFAULT_TIMESTAMP_SCALE	1000000
+
+/*
+ * Element - header of an EBML element and where its data lies
+ */
+struct ebml_elem {
+	uint32_t id;
+	off_t data;
+	off_t end;		/* limit of the parent if the size is unknown */
+	int unknown;		/* size not known, as in live streams */
+};
+
+/*
+ * Reader - pread() through a small window, so consecutive headers
+ * share a read while skipped data is never read
+ */
+struct mkv_reader {
+	int fd;
+	off_t size;
+	unsigned char buf[MKV_READ_WINDOW];
+	off_t buf_off;
+	size_t buf_len;
+};
+
+/*
+ * Cue - a subtitle block, until the cues are sorted by time
+ */
+struct mkv_cue {
+	int64_t start;		/* in TimestampScale units */
+	int64_t duration;	/* -1 if the block has none */
+	size_t text;		/* offset in the text buffer */
+	size_t len;
+	long seq;
+};
+
+/*
+ * Index entry - a cluster, and a block in it if the index says where
+ */
+struct mkv_target {
+	off_t cluster;
+	off_t block;		/* from the cluster data, -1 if unknown */
+};
+
+struct mkv_parser {
+	struct mkv_reader r;
+	off_t segment;		/* start of the segment data */
+	off_t segment_end;
+	off_t info, tracks, cues;	/* element offsets, -1 if unknown */
+	uint64_t scale;
+	uint64_t track;		/* number of the subtitle track */
+	struct mkv_cue *cue;
+	int count;
+	int capacity;
+	char *text;
+	size_t text_len;
+	size_t text_cap;
+};
+
+static int mkv_read(struct mkv_reader *r, off_t off, void *dst, size_t n)
+{
+	ssize_t got;
+
+	if (off < 0 || off > r->size || (off_t)n > r->size - off)
+		return -1;
+
+	if (n > sizeof(r->buf)) {
+		got = pread(r->fd, dst, n, off);
+		return got == (ssize_t)n ? 0 : -1;
+	}
+
+	if (off < r->buf_off || off + (off_t)n > r->buf_off +
+					       (off_t)r->buf_len) {
+		got = pread(r->fd, r->buf, sizeof(r->buf), off);
+		if (got < (ssize_t)n)
+			return -1;
+		r->buf_off = off;
+		r->buf_len = got;
+	}
+
+	memcpy(dst, r->buf + (off - r->buf_off), n);
+	return 0;
+}
+
+/*
+ * Decode the variable-length integer at @p. IDs keep their length
+ * marker; sizes drop it, and a size with every bit set is unknown.
+ * Returns its length, or 0 if it is invalid or runs past @avail.
+ */
+static int read_vint(const unsigned char *p, size_t avail, int keep_marker,
+		     uint64_t *value, int *all_ones)
+{
+	int len = 1;
+	uint64_t v;
+	int i;
+
+	if (avail == 0 || p[0] == 0)
+		return 0;
+
+	while (!(p[0] & (0x80 >> (len - 1))))
+		len++;
+	if ((size_t)len > avail)
+		return 0;
+
+	v = keep_marker ? p[0] : p[0] & (0xFF >> len);
+	*all_ones = v == (uint64_t)(0xFF >> len);
+	for (i = 1; i < len; i++) {
+		v = (v << 8) | p[i];
+		*all_ones &= p[i] == 0xFF;
+	}
+
+	*value = v;
+	return len;
+}
+
+/*
+ * Read the header of the element at @off, which must end by @limit.
+ */
+static int read_elem(struct mkv_reader *r, off_t off, off_t limit,
+		     struct ebml_elem *e)
+{
+	unsigned char hdr[12];
+	size_t avail;
+	uint64_t id, size;
+	int ilen, slen, ones;
+
+	/* A truncated file ends its elements early */
+	if (limit > r->size)
+		limit = r->size;
+	if (off >= limit)
+		return -1;
+
+	avail = limit - off < (off_t)sizeof(hdr) ? (size_t)(limit - off) :
+						   sizeof(hdr);
+	if (mkv_read(r, off, hdr, avail) < 0)
+		return -1;
+
+	ilen = read_vint(hdr, avail, 1, &id, &ones);
+	if (ilen == 0 || ilen > 4)
+		return -1;
+	slen = read_vint(hdr + ilen, avail - ilen, 0, &size, &ones);
+	if (slen == 0)
+		return -1;
+
+	e->id = (uint32_t)id;
+	e->data = off + ilen + slen;
+	e->unknown = ones;
+	if (ones) {
+		e->end = limit;
+	} else {
+		if (size <= (uint64_t)(limit - e->data))
+			e->end = e->data + (off_t)size;
+		else if (limit == r->size &&
+			 (id == ID_SEGMENT || id == ID_CLUSTER))
+			e->end = limit;	/* cut off with the file */
+		else
+			return -1;
+	}
+	return 0;
+}
+
+static int read_uint(struct mkv_reader *r, const struct ebml_elem *e,
+		     uint64_t *value)
+{
+	unsigned char b[8];
+	size_t n = e->end - e->data;
+	size_t i;
+
+	if (n > sizeof(b) || mkv_read(r, e->data, b, n) < 0)
+		return -1;
+
+	*value = 0;
+	for (i = 0; i < n; i++)
+		*value = (*value << 8) | b[i];
+	return 0;
+}
+
+static int read_string(struct mkv_reader *r, const struct ebml_elem *e,
+		       char *buf, size_t size)
+{
+	size_t n = e->end - e->data;
+
+	if (n >= size || mkv_read(r, e->data, buf, n) < 0)
+		return -1;
+	buf[n] = '\0';
+	return 0;
+}
+
+static int is_top_level(uint32_t id)
+{
+	return id == ID_CLUSTER || id == ID_CUES || id == ID_SEEKHEAD ||
+	       id == ID_INFO || id == ID_TRACKS || id == ID_TAGS ||
+	       id == ID_CHAPTERS || id == ID_ATTACHMENTS;
+}
+
+/*
+ * Find where an element of unknown size ends: at the first top-level
+ * element after its data.
+ */
+static off_t unknown_end(struct mkv_reader *r, const struct ebml_elem *e)
+{
+	struct ebml_elem c;
+	off_t off = e->data;
+
+	while (off < e->end && read_elem(r, off, e->end, &c) == 0) {
+		if (is_top_level(c.id) || c.unknown)
+			return off;
+		off = c.end;
+	}
+	return e->end;
+}
+
+static void parse_seekhead(struct mkv_parser *mp, const struct ebml_elem *sh)
+{
+	struct ebml_elem seek, c;
+	off_t off, coff;
+
+	for (off = sh->data; read_elem(&mp->r, off, sh->end, &seek) == 0;
+	     off = seek.end) {
+		uint64_t id = 0, pos = 0;
+		int have_pos = 0;
+
+		if (seek.id != ID_SEEK)
+			continue;
+
+		for (coff = seek.data;
+		     read_elem(&mp->r, coff, seek.end, &c) == 0;
+		     coff = c.end) {
+			unsigned char b[4];
+			size_t n = c.end - c.data;
+			size_t i;
+
+			if (c.id == ID_SEEKID && n <= sizeof(b) &&
+			    mkv_read(&mp->r, c.data, b, n) == 0) {
+				for (id = 0, i = 0; i < n; i++)
+					id = (id << 8) | b[i];
+			} else if (c.id == ID_SEEKPOSITION) {
+				have_pos = read_uint(&mp->r, &c, &pos) == 0;
+			}
+		}
+
+		if (!have_pos || pos >= (uint64_t)(mp->segment_end -
+						    mp->segment))
+			continue;
+		if (id == ID_INFO)
+			mp->info = mp->segment + (off_t)pos;
+		else if (id == ID_TRACKS)
+			mp->tracks = mp->segment + (off_t)pos;
+		else if (id == ID_CUES)
+			mp->cues = mp->segment + (off_t)pos;
+	}
+}
+
+/*
+ * Locate Info, Tracks and Cues, from the SeekHead if there is one, or
+ * else by stepping over the top-level elements.
+ */
+static void find_top_level(struct mkv_parser *mp)
+{
+	struct ebml_elem e;
+	off_t off = mp->segment;
+
+	mp->info = mp->tracks = mp->cues = -1;
+
+	if (read_elem(&mp->r, off, mp->segment_end, &e) == 0 &&
+	    e.id == ID_SEEKHEAD)
+		parse_seekhead(mp, &e);
+
+	if (mp->tracks >= 0 && mp->cues >= 0)
+		return;
+
+	while (read_elem(&mp->r, off, mp->segment_end, &e) == 0) {
+		if (e.id == ID_INFO && mp->info < 0)
+			mp->info = off;
+		else if (e.id == ID_TRACKS && mp->tracks < 0)
+			mp->tracks = off;
+		else if (e.id == ID_CUES && mp->cues < 0)
+			mp->cues = off;
+		off = e.unknown ? unknown_end(&mp->r, &e) : e.end;
+	}
+}
+
+static void parse_info(struct mkv_parser *mp)
+{
+	struct ebml_elem info, c;
+	off_t off;
+
+	mp->scale = DEFAULT_TIMESTAMP_SCALE;
+	if (mp->info < 0 ||
+	    read_elem(&mp->r, mp->info, mp->segment_end, &info) < 0 ||
+	    info.id != ID_INFO)
+		return;
+
+	for (off = info.data; read_elem(&mp->r, off, info.end, &c) == 0;
+	     off = c.end) {
+		if (c.id == ID_TIMESTAMPSCALE &&
+		    (read_uint(&mp->r, &c, &mp->scale) < 0 || mp->scale == 0))
+			mp->scale = DEFAULT_TIMESTAMP_SCALE;
+	}
+}
+
+/*
+ * Pick the SRT track: the first Japanese one, or the first one. Tracks
+ * with compressed or encrypted content are not supported.
+ */
+static int parse_tracks(struct mkv_parser *mp)
+{
+	struct ebml_elem tracks, entry, c;
+	off_t off, coff;
+	int found = 0;
+
+	if (mp->tracks < 0 ||
+	    read_elem(&mp->r, mp->tracks, mp->segment_end, &tracks) < 0 ||
+	    tracks.id != ID_TRACKS)
+		return -1;
+
+	for (off = tracks.data;
+	     read_elem(&mp->r, off, tracks.end, &entry) == 0;
+	     off = entry.end) {
+		char codec[32] = "", lang[16] = "eng";
+		uint64_t number = 0;
+		int encoded = 0, japanese;
+
+		if (entry.id != ID_TRACKENTRY)
+			continue;
+
+		for (coff = entry.data;
+		     read_elem(&mp->r, coff, entry.end, &c) == 0;
+		     coff = c.end) {
+			if (c.id == ID_TRACKNUMBER)
+				read_uint(&mp->r, &c, &number);
+			else if (c.id == ID_CODECID)
+				read_string(&mp->r, &c, codec, sizeof(codec));
+			else if (c.id == ID_LANGUAGE ||
+				 c.id == ID_LANGUAGEBCP47)
+				read_string(&mp->r, &c, lang, sizeof(lang));
+			else if (c.id == ID_CONTENTENCODINGS)
+				encoded = 1;
+		}
+
+		if (strcmp(codec, SRT_CODEC) != 0 || encoded || number == 0)
+			continue;
+
+		japanese = strcmp(lang, "jpn") == 0 ||
+			   strncmp(lang, "ja", 2) == 0;
+		if (!found || japanese)
+			mp->track = number;
+		found = 1;
+		if (japanese)
+			break;
+	}
+	return found ? 0 : -1;
+}
+
+static int add_text(struct mkv_parser *mp, off_t off, size_t len,
+		    struct mkv_cue *cue)
+{
+	char *text, *dst, *src;
+
+	if (mp->text_len + len > mp->text_cap) {
+		size_t cap = mp->text_cap ? mp->text_cap : 4096;
+
+		while (cap < mp->text_len + len)
+			cap *= 2;
+		text = mem_realloc(mp->text, cap);
+		if (!text)
+			return -1;
+		mp->text = text;
+		mp->text_cap = cap;
+	}
+
+	text = mp->text + mp->text_len;
+	if (mkv_read(&mp->r, off, text, len) < 0)
+		return -1;
+
+	/* The payload is the text of an SRT cue: drop CRs and final EOLs */
+	for (src = dst = text; src < text + len; src++) {
+		if (*src != '\r')
+			*dst++ = *src;
+	}
+	while (dst > text && dst[-1] == '\n')
+		dst--;
+
+	cue->text = mp->text_len;
+	cue->len = dst - text;
+	mp->text_len += cue->len;
+	return 0;
+}
+
+/*
+ * Record the block with @size bytes of data at @data if it belongs to
+ * the subtitle track. Laced blocks never carry subtitles.
+ */
+static int add_block(struct mkv_parser *mp, off_t data, off_t size,
+		     int64_t cluster_ts, int64_t duration)
+{
+	unsigned char hdr[12];
+	size_t avail = size < (off_t)sizeof(hdr) ? (size_t)size : sizeof(hdr);
+	uint64_t track;
+	int len, ones;
+	struct mkv_cue *cue;
+
+	if (mkv_read(&mp->r, data, hdr, avail) < 0)
+		return 0;
+
+	len = read_vint(hdr, avail, 0, &track, &ones);
+	if (len == 0 || track != mp->track || (size_t)len + 3 > avail ||
+	    (hdr[len + 2] & 0x06))
+		return 0;
+
+	if (mp->count >= mp->capacity) {
+		int capacity = mp->capacity ? mp->capacity * 2 :
+					      INITIAL_SUB_CAPACITY;
+
+		cue = mem_realloc(mp->cue, capacity * sizeof(struct mkv_cue));
+		if (!cue)
+			return -1;
+		mp->cue = cue;
+		mp->capacity = capacity;
+	}
+
+	cue = &mp->cue[mp->count];
+	cue->start = cluster_ts + (int16_t)((hdr[len] << 8) | hdr[len + 1]);
+	cue->duration = duration;
+	cue->seq = mp->count;
+	if (add_text(mp, data + len + 3, size - len - 3, cue) < 0)
+		return -1;
+
+	mp->count++;
+	return 0;
+}
+
+static int parse_blockgroup(struct mkv_parser *mp, const struct ebml_elem *g,
+			    int64_t cluster_ts)
+{
+	struct ebml_elem c, block = {0};
+	uint64_t duration;
+	int64_t dur = -1;
+	off_t off;
+
+	for (off = g->data; read_elem(&mp->r, off, g->end, &c) == 0;
+	     off = c.end) {
+		if (c.id == ID_BLOCK)
+			block = c;
+		else if (c.id == ID_BLOCKDURATION &&
+			 read_uint(&mp->r, &c, &duration) == 0)
+			dur = (int64_t)duration;
+	}
+
+	if (block.id != ID_BLOCK)
+		return 0;
+	return add_block(mp, block.data, block.end - block.data, cluster_ts,
+			 dur);
+}
+
+static int parse_block_at(struct mkv_parser *mp, off_t off, off_t limit,
+			  int64_t cluster_ts)
+{
+	struct ebml_elem e;
+
+	if (read_elem(&mp->r, off, limit, &e) < 0)
+		return 0;
+	if (e.id == ID_SIMPLEBLOCK)
+		return add_block(mp, e.data, e.end - e.data, cluster_ts, -1);
+	if (e.id == ID_BLOCKGROUP)
+		return parse_blockgroup(mp, &e, cluster_ts);
+	return 0;
+}
+
+/*
+ * Read the header of the cluster at @off and its timestamp, which
+ * comes before its blocks.
+ */
+static int open_cluster(struct mkv_parser *mp, off_t off,
+			struct ebml_elem *cl, int64_t *ts)
+{
+	struct ebml_elem c;
+	uint64_t v;
+
+	if (read_elem(&mp->r, off, mp->segment_end, cl) < 0 ||
+	    cl->id != ID_CLUSTER)
+		return -1;
+	if (cl->unknown)
+		cl->end = unknown_end(&mp->r, cl);
+
+	*ts = 0;
+	for (off = cl->data; read_elem(&mp->r, off, cl->end, &c) == 0;
+	     off = c.end) {
+		if (c.id == ID_TIMESTAMP) {
+			if (read_uint(&mp->r, &c, &v) == 0)
+				*ts = (int64_t)v;
+			break;
+		}
+		if (c.id == ID_SIMPLEBLOCK || c.id == ID_BLOCKGROUP)
+			break;
+	}
+	return 0;
+}
+
+/*
+ * Go through every block of the cluster at @off.
+ */
+static int scan_cluster(struct mkv_parser *mp, off_t off)
+{
+	struct ebml_elem cl, c;
+	int64_t ts;
+
+	if (open_cluster(mp, off, &cl, &ts) < 0)
+		return 0;
+
+	for (off = cl.data; read_elem(&mp->r, off, cl.end, &c) == 0;
+	     off = c.end) {
+		if (c.id == ID_SIMPLEBLOCK || c.id == ID_BLOCKGROUP) {
+			if (parse_block_at(mp, off, cl.end, ts) < 0)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static int compare_targets(const void *a, const void *b)
+{
+	const struct mkv_target *ta = a, *tb = b;
+
+	if (ta->cluster != tb->cluster)
+		return ta->cluster < tb->cluster ? -1 : 1;
+	if (ta->block != tb->block)
+		return ta->block < tb->block ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Collect the index entries of the subtitle track. Returns their
+ * number, or -1.
+ */
+static int parse_cues(struct mkv_parser *mp, struct mkv_target **out)
+{
+	struct ebml_elem cues, point, pos, c;
+	struct mkv_target *t = NULL, *tmp;
+	int count = 0, capacity = 0;
+	off_t off, poff, coff;
+
+	*out = NULL;
+	if (mp->cues < 0 ||
+	    read_elem(&mp->r, mp->cues, mp->segment_end, &cues) < 0 ||
+	    cues.id != ID_CUES)
+		return 0;
+
+	for (off = cues.data; read_elem(&mp->r, off, cues.end, &point) == 0;
+	     off = point.end) {
+		if (point.id != ID_CUEPOINT)
+			continue;
+
+		for (poff = point.data;
+		     read_elem(&mp->r, poff, point.end, &pos) == 0;
+		     poff = pos.end) {
+			uint64_t track = 0, cluster = 0, block = 0;
+			int have_cluster = 0, have_block = 0;
+
+			if (pos.id != ID_CUETRACKPOSITIONS)
+				continue;
+
+			for (coff = pos.data;
+			     read_elem(&mp->r, coff, pos.end, &c) == 0;
+			     coff = c.end) {
+				if (c.id == ID_CUETRACK)
+					read_uint(&mp->r, &c, &track);
+				else if (c.id == ID_CUECLUSTERPOSITION)
+					have_cluster = read_uint(&mp->r, &c,
+								 &cluster) == 0;
+				else if (c.id == ID_CUERELATIVEPOSITION)
+					have_block = read_uint(&mp->r, &c,
+							       &block) == 0;
+			}
+
+			if (track != mp->track || !have_cluster ||
+			    cluster >= (uint64_t)(mp->segment_end -
+						  mp->segment))
+				continue;
+
+			if (count >= capacity) {
+				capacity = capacity ? capacity * 2 :
+						      INITIAL_SUB_CAPACITY;
+				tmp = realloc(t, capacity * sizeof(*t));
+				if (!tmp) {
+					free(t);
+					return -1;
+				}
+				t = tmp;
+			}
+			t[count].cluster = mp->segment + (off_t)cluster;
+			t[count].block = have_block ? (off_t)block : -1;
+			count++;
+		}
+	}
+
+	if (count > 1)
+		qsort(t, count, sizeof(*t), compare_targets);
+	*out = t;
+	return count;
+}
+
+/*
+ * Read the blocks the index points at, in file order. A cluster with an
+ * entry that does not say where its block is gets scanned whole, once.
+ */
+static int read_indexed(struct mkv_parser *mp, struct mkv_target *t, int n)
+{
+	struct ebml_elem cl;
+	off_t cur = -1, scanned = -1;
+	int64_t ts = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		/* Entries without a block sort first in their cluster */
+		if (t[i].cluster == scanned ||
+		    (i > 0 && compare_targets(&t[i], &t[i - 1]) == 0))
+			continue;
+
+		if (t[i].block < 0) {
+			scanned = t[i].cluster;
+			if (scan_cluster(mp, scanned) < 0)
+				return -1;
+			continue;
+		}
+
+		if (t[i].cluster != cur) {
+			cur = -1;
+			if (open_cluster(mp, t[i].cluster, &cl, &ts) < 0)
+				continue;
+			cur = t[i].cluster;
+		}
+		if (parse_block_at(mp, cl.data + t[i].block, cl.end, ts) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int read_all_clusters(struct mkv_parser *mp)
+{
+	struct ebml_elem e;
+	off_t off = mp->segment;
+
+	while (read_elem(&mp->r, off, mp->segment_end, &e) == 0) {
+		if (e.id == ID_CLUSTER && scan_cluster(mp, off) < 0)
+			return -1;
+		off = e.unknown ? unknown_end(&mp->r, &e) : e.end;
+	}
+	return 0;
+}
+
+static int compare_cues(const void *a, const void *b)
+{
+	const struct mkv_cue *ca = a, *cb = b;
+
+	if (ca->start != cb->start)
+		return ca->start < cb->start ? -1 : 1;
+	return ca->seq < cb->seq ? -1 : ca->seq > cb->seq;
+}
+
+static int to_ms(const struct mkv_parser *mp, int64_t t)
+{
+	return (int)((double)t * mp->scale / 1e6);
+}
+
+/*
+ * Turn the blocks into subtitles in time order. A block without a
+ * duration lasts until the next one.
+ */
+static int build_subs(struct mkv_parser *mp, struct srt_file *srt)
+{
+	int i;
+
+	if (mp->count > 1)
+		qsort(mp->cue, mp->count, sizeof(struct mkv_cue),
+		      compare_cues);
+
+	srt->subs = mem_malloc((mp->count ? mp->count : 1) *
+			   sizeof(struct subtitle));
+	if (!srt->subs)
+		return -1;
+
+	for (i = 0; i < mp->count; i++) {
+		const struct mkv_cue *c = &mp->cue[i];
+		struct subtitle *sub = &srt->subs[i];
+		int64_t end;
+
+		if (c->duration >= 0)
+			end = c->start + c->duration;
+		else if (i + 1 < mp->count)
+			end = mp->cue[i + 1].start;
+		else
+			end = c->start;
+
+		sub->start_ms = to_ms(mp, c->start);
+		sub->end_ms = to_ms(mp, end);
+		sub->text = c->len ? mp->text + c->text : "";
+		sub->len = c->len;
+	}
+
+	srt->count = mp->count;
+	srt->text = mp->text;
+	mp->text = NULL;
+	return 0;
+}
+
+static int find_segment(struct mkv_parser *mp)
+{
+	struct ebml_elem e;
+	off_t off = 0;
+
+	while (read_elem(&mp->r, off, mp->r.size, &e) == 0) {
+		if (e.id == ID_SEGMENT) {
+			mp->segment = e.data;
+			mp->segment_end = e.end;
+			return 0;
+		}
+		if (e.unknown)
+			break;
+		off = e.end;
+	}
+	return -1;
+}
+
+/*
+ * Read the SRT track of the Matroska file at @path into @srt, released
+ * with srt_close(). Returns -1 with errno set on failure, ENODATA if
+ * the file has no usable SRT track.
+ */
+int mkv_open(struct srt_file *srt, const char *path)
+{
+	struct mkv_parser *mp;
+	struct mkv_target *t;
+	struct stat st;
+	int n, ret = -1, err = EINVAL;
+
+	memset(srt, 0, sizeof(*srt));
+
+	mp = calloc(1, sizeof(*mp));
+	if (!mp)
+		return -1;
+
+	mp->r.fd = open(path, O_RDONLY);
+	if (mp->r.fd < 0 || fstat(mp->r.fd, &st) < 0) {
+		err = errno;
+		goto out;
+	}
+	mp->r.size = st.st_size;
+
+	if (find_segment(mp) < 0)
+		goto out;
+
+	find_top_level(mp);
+	parse_info(mp);
+	if (parse_tracks(mp) < 0) {
+		err = ENODATA;
+		goto out;
+	}
+
+	err = ENOMEM;
+	n = parse_cues(mp, &t);
+	if (n < 0)
+		goto out;
+
+	/* Without an index of the track, every cluster is visited */
+	if (n > 0)
+		ret = read_indexed(mp, t, n);
+	else
+		ret = read_all_clusters(mp);
+	free(t);
+
+	if (ret == 0)
+		ret = build_subs(mp, srt);
+	if (ret < 0)
+		srt_close(srt);
+
+out:
+	if (mp->r.fd >= 0)
+		close(mp->r.fd);
+	mem_free(mp->text);
+	mem_free(mp->cue);
+	free(mp);
+	if (ret < 0)
+		errno = err;
+	return ret;
+}
@@ -0,0 +1,167 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - outbuf.c
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ *
+ * Numbers are formatted by hand, as printf() spends most of its time
+ * parsing the format and handling cases events never need.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "outbuf.h"
+#include "types.h"
+#include "mem.h"
+
+void outbuf_init(struct outbuf *ob)
+{
+	memset(ob, 0, sizeof(*ob));
+}
+
+/*
+ * Make room for @n more bytes. Returns a pointer to them, or NULL once
+ * the buffer has failed.
+ */
+static char *outbuf_reserve(struct outbuf *ob, size_t n)
+{
+	size_t cap;
+	char *tmp;
+
+	if (ob->failed)
+		return NULL;
+	if (ob->cap - ob->len >= n)
+		return ob->data + ob->len;
+
+	cap = ob->cap ? ob->cap : OUTBUF_INITIAL_SIZE;
+	while (cap - ob->len < n)
+		cap *= 2;
+
+	tmp = mem_realloc(ob->data, cap);
+	if (!tmp) {
+		ob->failed = 1;
+		return NULL;
+	}
+	ob->data = tmp;
+	ob->cap = cap;
+	return ob->data + ob->len;
+}
+
+void outbuf_put(struct outbuf *ob, const char *s, size_t len)
+{
+	char *p = outbuf_reserve(ob, len);
+
+	if (!p)
+		return;
+	memcpy(p, s, len);
+	ob->len += len;
+}
+
+void outbuf_puts(struct outbuf *ob, const char *s)
+{
+	outbuf_put(ob, s, strlen(s));
+}
+
+/*
+ * Write the digits of @v, most significant first, ending at @end.
+ * Returns where they start.
+ */
+static char *format_digits(char *end, unsigned long long v)
+{
+	do {
+		*--end = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	return end;
+}
+
+/* As "%d" */
+void outbuf_int(struct outbuf *ob, int n)
+{
+	char tmp[16], *end = tmp + sizeof(tmp), *p;
+	unsigned int v = n < 0 ? 0u - (unsigned int)n : (unsigned int)n;
+
+	p = format_digits(end, v);
+	if (n < 0)
+		*--p = '-';
+	outbuf_put(ob, p, end - p);
+}
+
+/*
+ * As "%.1f". A float times ten is exact as a double, so rounding it to
+ * an integer, half to even, gives the digits printf() would print.
+ */
+void outbuf_fixed1(struct outbuf *ob, float x)
+{
+	char tmp[48], *end = tmp + sizeof(tmp), *p;
+	double t = (double)x * 10.0;
+	unsigned long long k;
+	double frac;
+	int neg = signbit(t) != 0;
+
+	/* Beyond what an event position can be, leave it to printf() */
+	if (!(t > -1e15 && t < 1e15)) {
+		int n = snprintf(tmp, sizeof(tmp), "%.1f", x);
+
+		if (n > 0 && (size_t)n < sizeof(tmp))
+			outbuf_put(ob, tmp, n);
+		return;
+	}
+
+	if (neg)
+		t = -t;
+	k = (unsigned long long)t;
+	frac = t - (double)k;
+	if (frac > 0.5 || (frac == 0.5 && (k & 1)))
+		k++;
+
+	p = end;
+	*--p = '0' + k % 10;
+	*--p = '.';
+	p = format_digits(p, k / 10);
+	if (neg)
+		*--p = '-';
+	outbuf_put(ob, p, end - p);
+}
+
+/*
+ * Write the buffered text to @f in one block and empty the buffer.
+ */
+int outbuf_flush(struct outbuf *ob, FILE *f)
+{
+	int ret = 0;
+
+	if (ob->failed)
+		return -1;
+	if (ob->len && fwrite(ob->data, 1, ob->len, f) != ob->len)
+		ret = -1;
+	ob->len = 0;
+	return ret;
+}
+
+/*
+ * Hand the text over to the caller, who frees it. Returns NULL if the
+ * buffer failed.
+ */
+char *outbuf_release(struct outbuf *ob, size_t *len)
+{
+	char *data = ob->data;
+
+	if (ob->failed) {
+		outbuf_free(ob);
+		return NULL;
+	}
+	*len = ob->len;
+	outbuf_init(ob);
+	return data;
+}
+
+void outbuf_free(struct outbuf *ob)
+{
+	mem_free(ob->data);
+	outbuf_init(ob);
+}
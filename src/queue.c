@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - queue.c
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+
+#include "queue.h"
+#include "utils.h"
+
+int queue_init(struct queue *q, int capacity, int producers)
+{
+	q->items = malloc(capacity * sizeof(void *));
+	if (!q->items)
+		return -1;
+
+	q->capacity = capacity;
+	q->head = 0;
+	q->count = 0;
+	q->producers = producers;
+	q->last_change = monotonic_seconds();
+	q->depth_area = 0.0;
+	q->full_wait = 0.0;
+	q->empty_wait = 0.0;
+	q->pushed = 0;
+
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+	return 0;
+}
+
+void queue_destroy(struct queue *q)
+{
+	pthread_cond_destroy(&q->not_full);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_mutex_destroy(&q->lock);
+	free(q->items);
+	q->items = NULL;
+}
+
+/* Account for the time spent at the current depth. Called locked. */
+static void queue_sample(struct queue *q)
+{
+	double now = monotonic_seconds();
+
+	q->depth_area += q->count * (now - q->last_change);
+	q->last_change = now;
+}
+
+int queue_push(struct queue *q, void *item)
+{
+	pthread_mutex_lock(&q->lock);
+
+	if (q->count == q->capacity) {
+		double start = monotonic_seconds();
+
+		while (q->count == q->capacity)
+			pthread_cond_wait(&q->not_full, &q->lock);
+		q->full_wait += monotonic_seconds() - start;
+	}
+
+	queue_sample(q);
+	q->items[(q->head + q->count) % q->capacity] = item;
+	q->count++;
+	q->pushed++;
+
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->lock);
+	return 0;
+}
+
+/*
+ * Take the oldest item, blocking while the queue is empty.
+ * Returns NULL once every producer has closed and the queue is drained.
+ */
+void *queue_pop(struct queue *q)
+{
+	return queue_pop_cancel(q, NULL, NULL);
+}
+
+/*
+ * Like queue_pop(), but also gives up and returns NULL while the queue
+ * is empty as soon as @cancel(@arg) is true. It is evaluated with the
+ * queue locked; queue_wake() makes blocked consumers re-check it.
+ */
+void *queue_pop_cancel(struct queue *q, int (*cancel)(void *), void *arg)
+{
+	void *item = NULL;
+
+	pthread_mutex_lock(&q->lock);
+
+	if (q->count == 0 && q->producers > 0 && !(cancel && cancel(arg))) {
+		double start = monotonic_seconds();
+
+		while (q->count == 0 && q->producers > 0 &&
+		       !(cancel && cancel(arg)))
+			pthread_cond_wait(&q->not_empty, &q->lock);
+		q->empty_wait += monotonic_seconds() - start;
+	}
+
+	if (q->count > 0) {
+		queue_sample(q);
+		item = q->items[q->head];
+		q->head = (q->head + 1) % q->capacity;
+		q->count--;
+		pthread_cond_signal(&q->not_full);
+	}
+
+	pthread_mutex_unlock(&q->lock);
+	return item;
+}
+
+void queue_wake(struct queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	pthread_cond_broadcast(&q->not_empty);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/*
+ * True once every producer has closed and the queue is drained.
+ */
+int queue_drained(struct queue *q)
+{
+	int drained;
+
+	pthread_mutex_lock(&q->lock);
+	drained = q->count == 0 && q->producers == 0;
+	pthread_mutex_unlock(&q->lock);
+	return drained;
+}
+
+/*
+ * Called by each producer when it is done; consumers are released once
+ * the last producer has closed.
+ */
+void queue_close(struct queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	if (--q->producers == 0) {
+		queue_sample(q);
+		pthread_cond_broadcast(&q->not_empty);
+	}
+	pthread_mutex_unlock(&q->lock);
+}
@@ -2,15 +2,27 @@
 /*
  * Furigana4subtitles - srt.c
  * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ *
+ * The file is mapped and parsed in place: the text of a cue is a view of
+ * its lines in the mapping. Only cues with CRLF line ends spanning more
+ * than one line are rewritten, which touches (and copies) just their
+ * pages of the private mapping.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "srt.h"
 #include "types.h"
+#include "mem.h"
 
 enum parse_state {
 	STATE_INDEX,
@@ -18,50 +30,179 @@ enum parse_state {
 	STATE_TEXT
 };
 
-static int parse_time_line(const char *line, struct subtitle *sub)
+/*
+ * Parser - position in the mapping and the cue being read
+ */
+struct srt_parser {
+	const char *path;
+	char *pos;
+	char *end;
+	int lineno;
+	char *text;		/* first text line of the cue */
+	char *text_end;		/* end of its last text line */
+	int crlf;		/* a text line ended with CRLF */
+};
+
+static int is_digit(char c)
+{
+	return (unsigned char)(c - '0') < 10;
+}
+
+static int is_blank(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static int has_arrow(const char *line, const char *end)
+{
+	const char *p = line;
+
+	while ((p = memchr(p, '-', end - p)) != NULL) {
+		if (end - p >= 3 && p[1] == '-' && p[2] == '>')
+			return 1;
+		p++;
+	}
+	return 0;
+}
+
+/*
+ * Parse an unsigned number of at least one digit at *@p.
+ */
+static int parse_number(const char **p, const char *end, int *out)
 {
-	int h1, m1, s1, ms1;
-	int h2, m2, s2, ms2;
+	const char *s = *p;
+	int n = 0;
 
-	if (sscanf(line, "%d:%d:%d,%d --> %d:%d:%d,%d",
-		   &h1, &m1, &s1, &ms1, &h2, &m2, &s2, &ms2) != 8)
+	if (s >= end || !is_digit(*s))
 		return -1;
 
-	sub->start_ms = h1 * MS_PER_HOUR + m1 * MS_PER_MINUTE +
-			s1 * MS_PER_SECOND + ms1;
-	sub->end_ms = h2 * MS_PER_HOUR + m2 * MS_PER_MINUTE +
-		      s2 * MS_PER_SECOND + ms2;
+	while (s < end && is_digit(*s) && n < 100000000)
+		n = n * 10 + (*s++ - '0');
+
+	*p = s;
+	*out = n;
 	return 0;
 }
 
-static int append_text(struct subtitle *sub, const char *line)
+/*
+ * Parse a timestamp, HH:MM:SS,mmm or HH:MM:SS.mmm, at *@p. The usual
+ * two-digit fields are read without branching; other widths go through
+ * parse_number().
+ */
+static int parse_timestamp(const char **p, const char *end, int *ms)
 {
-	size_t old_len, add_len;
-	char *tmp;
+	const char *s = *p;
+	int h, m, sec, frac;
 
-	old_len = sub->text ? strlen(sub->text) : 0;
-	add_len = strlen(line);
+	while (s < end && is_blank(*s))
+		s++;
 
-	tmp = realloc(sub->text, old_len + add_len + 2);
-	if (!tmp)
+	if (end - s >= 12 && s[2] == ':' && s[5] == ':' &&
+	    (s[8] == ',' || s[8] == '.') &&
+	    (is_digit(s[0]) & is_digit(s[1]) & is_digit(s[3]) &
+	     is_digit(s[4]) & is_digit(s[6]) & is_digit(s[7]) &
+	     is_digit(s[9]) & is_digit(s[10]) & is_digit(s[11])) &&
+	    (end - s == 12 || !is_digit(s[12]))) {
+		*ms = ((s[0] - '0') * 10 + (s[1] - '0')) * MS_PER_HOUR +
+		      ((s[3] - '0') * 10 + (s[4] - '0')) * MS_PER_MINUTE +
+		      ((s[6] - '0') * 10 + (s[7] - '0')) * MS_PER_SECOND +
+		      (s[9] - '0') * 100 + (s[10] - '0') * 10 + (s[11] - '0');
+		*p = s + 12;
+		return 0;
+	}
+
+	if (parse_number(&s, end, &h) < 0 || s >= end || *s++ != ':' ||
+	    parse_number(&s, end, &m) < 0 || s >= end || *s++ != ':' ||
+	    parse_number(&s, end, &sec) < 0 || s >= end ||
+	    (*s != ',' && *s != '.'))
+		return -1;
+	s++;
+	if (parse_number(&s, end, &frac) < 0)
 		return -1;
 
-	sub->text = tmp;
-	if (old_len) {
-		sub->text[old_len] = '\n';
-		strcpy(sub->text + old_len + 1, line);
-	} else {
-		strcpy(sub->text, line);
-	}
+	*ms = h * MS_PER_HOUR + m * MS_PER_MINUTE + sec * MS_PER_SECOND +
+	      frac;
+	*p = s;
 	return 0;
 }
 
+static int parse_time_line(const char *line, const char *end,
+			   struct subtitle *sub)
+{
+	const char *p = line;
+
+	if (parse_timestamp(&p, end, &sub->start_ms) < 0)
+		return -1;
+
+	while (p < end && is_blank(*p))
+		p++;
+	if (end - p < 3 || memcmp(p, "-->", 3) != 0)
+		return -1;
+	p += 3;
+
+	return parse_timestamp(&p, end, &sub->end_ms);
+}
+
+/*
+ * Return the next line and its end, without the line terminator, or
+ * NULL at the end of the mapping.
+ */
+static char *next_line(struct srt_parser *ps, char **line_end, int *crlf)
+{
+	char *line = ps->pos;
+	char *nl;
+
+	if (line >= ps->end)
+		return NULL;
+
+	nl = memchr(line, '\n', ps->end - line);
+	if (!nl)
+		nl = ps->end;
+
+	ps->pos = nl < ps->end ? nl + 1 : nl;
+	ps->lineno++;
+
+	*crlf = nl > line && nl[-1] == '\r';
+	*line_end = *crlf ? nl - 1 : nl;
+	return line;
+}
+
+/*
+ * Drop the CR of every CRLF between @text and @end. Returns the new end.
+ */
+static char *strip_cr(char *text, char *end)
+{
+	char *dst = text, *src = text;
+
+	while (src < end) {
+		if (*src == '\r' && src + 1 < end && src[1] == '\n')
+			src++;
+		*dst++ = *src++;
+	}
+	return dst;
+}
+
+static void end_cue(struct srt_parser *ps, struct subtitle *sub)
+{
+	if (!ps->text) {
+		sub->text = "";
+		sub->len = 0;
+		return;
+	}
+
+	if (ps->crlf)
+		ps->text_end = strip_cr(ps->text, ps->text_end);
+
+	sub->text = ps->text;
+	sub->len = ps->text_end - ps->text;
+}
+
 static int grow_subs_array(struct subtitle **subs, int *capacity)
 {
 	struct subtitle *tmp;
 
 	*capacity *= 2;
-	tmp = realloc(*subs, *capacity * sizeof(struct subtitle));
+	tmp = mem_realloc(*subs, *capacity * sizeof(struct subtitle));
 	if (!tmp)
 		return -1;
 
@@ -69,82 +210,262 @@ static int grow_subs_array(struct subtitle **subs, int *capacity)
 	return 0;
 }
 
-static void free_subs(struct subtitle *subs, int count)
+static int parse_cues(struct srt_file *srt, struct srt_parser *ps)
 {
-	int i;
-
-	for (i = 0; i < count; i++)
-		free(subs[i].text);
-	free(subs);
-}
-
-struct subtitle *parse_srt(const char *path, int *count)
-{
-	FILE *f;
-	struct subtitle *subs;
-	char line[MAX_LINE];
 	enum parse_state state = STATE_INDEX;
 	int capacity = INITIAL_SUB_CAPACITY;
-	int idx = -1;
-
-	*count = 0;
+	struct subtitle *sub = NULL;
+	char *line, *line_end;
+	int crlf;
 
-	f = fopen(path, "r");
-	if (!f)
-		return NULL;
-
-	subs = calloc(capacity, sizeof(struct subtitle));
-	if (!subs) {
-		fclose(f);
-		return NULL;
-	}
+	srt->subs = mem_malloc(capacity * sizeof(struct subtitle));
+	if (!srt->subs)
+		return -1;
 
-	while (fgets(line, sizeof(line), f)) {
-		line[strcspn(line, "\r\n")] = '\0';
+	/* A UTF-8 byte order mark is not part of the first index */
+	if (ps->end - ps->pos >= 3 && memcmp(ps->pos, "\xEF\xBB\xBF", 3) == 0)
+		ps->pos += 3;
 
+	while ((line = next_line(ps, &line_end, &crlf)) != NULL) {
 		switch (state) {
 		case STATE_INDEX:
-			if (isdigit((unsigned char)line[0]))
+			if (line < line_end && is_digit(*line))
 				state = STATE_TIME;
 			break;
 
 		case STATE_TIME:
-			if (!strstr(line, "-->"))
+			if (!has_arrow(line, line_end))
 				break;
 
-			if (*count >= capacity) {
-				if (grow_subs_array(&subs, &capacity) < 0) {
-					free_subs(subs, *count);
-					fclose(f);
-					*count = 0;
-					return NULL;
-				}
-			}
+			if (srt->count >= capacity &&
+			    grow_subs_array(&srt->subs, &capacity) < 0)
+				return -1;
 
-			if (parse_time_line(line, &subs[*count]) < 0)
+			sub = &srt->subs[srt->count];
+			if (parse_time_line(line, line_end, sub) < 0) {
+				fprintf(stderr, "%s:%d: malformed timestamp, "
+					"skipping cue\n", ps->path, ps->lineno);
 				break;
+			}
 
-			subs[*count].text = NULL;
-			idx = *count;
+			ps->text = NULL;
+			ps->crlf = 0;
 			state = STATE_TEXT;
 			break;
 
 		case STATE_TEXT:
-			if (line[0] == '\0') {
-				(*count)++;
-				idx = -1;
+			if (line == line_end) {
+				end_cue(ps, sub);
+				srt->count++;
 				state = STATE_INDEX;
-			} else if (idx >= 0) {
-				append_text(&subs[idx], line);
+				break;
 			}
+
+			if (!ps->text)
+				ps->text = line;
+			else
+				ps->crlf |= ps->text_end[0] == '\r';
+			ps->text_end = line_end;
 			break;
 		}
 	}
 
 	/* Handle last subtitle if file doesn't end with blank line */
-	if (state == STATE_TEXT && idx >= 0)
-		(*count)++;
+	if (state == STATE_TEXT) {
+		end_cue(ps, sub);
+		srt->count++;
+	}
+	return 0;
+}
+
+static int parse_buffer(struct srt_file *srt, const char *name, char *buf,
+			size_t len)
+{
+	struct srt_parser ps;
 
-	fclose(f);
-	return subs;
+	memset(&ps, 0, sizeof(ps));
+	ps.path = name;
+	ps.pos = buf;
+	ps.end = buf + len;
+
+	if (parse_cues(srt, &ps) < 0) {
+		srt_close(srt);
+		errno = ENOMEM;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Map and parse the SRT file at @path. Returns -1 with errno set on
+ * failure.
+ */
+int srt_open(struct srt_file *srt, const char *path)
+{
+	struct stat st;
+	int fd, err;
+
+	memset(srt, 0, sizeof(*srt));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	if (st.st_size > 0) {
+		srt->map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE, fd, 0);
+		if (srt->map == MAP_FAILED) {
+			err = errno;
+			srt->map = NULL;
+			close(fd);
+			errno = err;
+			return -1;
+		}
+		srt->map_len = st.st_size;
+	}
+	close(fd);
+
+	return parse_buffer(srt, path, srt->map, srt->map_len);
+}
+
+/*
+ * Parse the @len bytes of SRT at @buf, a buffer from mem_malloc() @srt
+ * takes over and frees in srt_close(). @name is used in diagnostics.
+ */
+int srt_parse(struct srt_file *srt, char *buf, size_t len, const char *name)
+{
+	memset(srt, 0, sizeof(*srt));
+	srt->text = buf;
+	return parse_buffer(srt, name, buf, len);
+}
+
+void srt_close(struct srt_file *srt)
+{
+	mem_free(srt->subs);
+	mem_free(srt->text);
+	if (srt->map)
+		munmap(srt->map, srt->map_len);
+	memset(srt, 0, sizeof(*srt));
+}
+
+void srt_stream_init(struct srt_stream *st, FILE *f, const char *name)
+{
+	memset(st, 0, sizeof(*st));
+	st->f = f;
+	st->name = name;
+}
+
+void srt_stream_free(struct srt_stream *st)
+{
+	free(st->line);
+	st->line = NULL;
+	st->line_cap = 0;
+}
+
+/*
+ * Append the @len bytes at @line to the text of a cue in *@buf, after a
+ * newline unless it is the first line.
+ */
+static int append_text(char **buf, size_t *cap, size_t *used,
+		       const char *line, size_t len)
+{
+	size_t need = *used + (*used > 0) + len;
+
+	if (need > *cap) {
+		size_t ncap = *cap ? *cap : 128;
+		char *tmp;
+
+		while (ncap < need)
+			ncap *= 2;
+		tmp = realloc(*buf, ncap);
+		if (!tmp)
+			return -1;
+		*buf = tmp;
+		*cap = ncap;
+	}
+
+	if (*used > 0)
+		(*buf)[(*used)++] = '\n';
+	memcpy(*buf + *used, line, len);
+	*used += len;
+	return 0;
+}
+
+static int stream_cue(struct subtitle *sub, const char *text, size_t len)
+{
+	sub->text = len ? text : "";
+	sub->len = len;
+	return 1;
+}
+
+/*
+ * Read the next cue of @st into @sub. Its text is kept in *@buf, which
+ * grows as needed and can be reused for the following cues.
+ * Returns 1 for a cue, 0 at the end of the input, -1 with errno set on
+ * failure.
+ */
+int srt_stream_next(struct srt_stream *st, struct subtitle *sub, char **buf,
+		    size_t *cap)
+{
+	enum parse_state state = STATE_INDEX;
+	size_t used = 0;
+	ssize_t n;
+
+	errno = 0;
+	while ((n = getline(&st->line, &st->line_cap, st->f)) >= 0) {
+		char *line = st->line, *line_end = st->line + n;
+
+		st->lineno++;
+		if (line_end > line && line_end[-1] == '\n')
+			line_end--;
+		if (line_end > line && line_end[-1] == '\r')
+			line_end--;
+
+		/* A UTF-8 byte order mark is not part of the first index */
+		if (st->lineno == 1 && line_end - line >= 3 &&
+		    memcmp(line, "\xEF\xBB\xBF", 3) == 0)
+			line += 3;
+
+		switch (state) {
+		case STATE_INDEX:
+			if (line < line_end && is_digit(*line))
+				state = STATE_TIME;
+			break;
+
+		case STATE_TIME:
+			if (!has_arrow(line, line_end))
+				break;
+
+			if (parse_time_line(line, line_end, sub) < 0) {
+				fprintf(stderr, "%s:%d: malformed timestamp, "
+					"skipping cue\n", st->name, st->lineno);
+				break;
+			}
+			state = STATE_TEXT;
+			break;
+
+		case STATE_TEXT:
+			if (line == line_end)
+				return stream_cue(sub, *buf, used);
+			if (append_text(buf, cap, &used, line,
+					line_end - line) < 0)
+				return -1;
+			break;
+		}
+	}
+
+	if (ferror(st->f))
+		return -1;
+
+	/* Handle last subtitle if input doesn't end with blank line */
+	if (state == STATE_TEXT)
+		return stream_cue(sub, *buf, used);
+	return 0;
 }
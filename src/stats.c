@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - stats.c
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ *
+ * Per-stage timers and counters of --stats. They are only collected
+ * when asked for: everything that fills them in checks for a stats
+ * pointer first, so a run without --stats does not read the clock.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+
+#include "stats.h"
+
+static const char *const timer_names[NR_STATS_TIMERS] = {
+	"walk", "parse", "mecab", "readings", "layout", "write"
+};
+
+void stats_add(struct conv_stats *to, const struct conv_stats *from)
+{
+	int i;
+
+	for (i = 0; i < NR_STATS_TIMERS; i++)
+		to->seconds[i] += from->seconds[i];
+	to->files += from->files;
+	to->cues += from->cues;
+	to->lines += from->lines;
+	to->nodes += from->nodes;
+	to->tokens += from->tokens;
+	to->bytes_read += from->bytes_read;
+	to->bytes_written += from->bytes_written;
+}
+
+/*
+ * Count the non-empty lines of @count cues, the lines that get a Main
+ * event.
+ */
+long stats_count_lines(const struct subtitle *subs, int count)
+{
+	long lines = 0;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		const char *p = subs[i].text;
+		const char *end = p + subs[i].len;
+
+		while (p < end) {
+			const char *nl = memchr(p, '\n', end - p);
+
+			if (nl != p)
+				lines++;
+			p = nl ? nl + 1 : end;
+		}
+	}
+	return lines;
+}
+
+/*
+ * Print @st, for a single file if @wall is negative and for a whole run
+ * of @wall seconds otherwise. Only a run has walk time.
+ */
+void stats_print(FILE *f, const struct conv_stats *st, double wall)
+{
+	const char *sep = "  ";
+	int i;
+
+	if (wall >= 0.0)
+		fprintf(f, "\nStats: %ld files in %.2f s\n", st->files, wall);
+
+	for (i = wall >= 0.0 ? 0 : STATS_PARSE; i < NR_STATS_TIMERS; i++) {
+		fprintf(f, "%s%s %.2f ms", sep, timer_names[i],
+			st->seconds[i] * 1e3);
+		sep = ", ";
+	}
+
+	fprintf(f, "\n  %ld cues, %ld lines, %ld MeCab nodes, %ld tokens, "
+		"%lld bytes read, %lld bytes written\n", st->cues, st->lines,
+		st->nodes, st->tokens, st->bytes_read, st->bytes_written);
+}
+
+static void json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+/*
+ * Print @st as one line of JSON: for the file at @path, or for a whole
+ * run of @wall seconds if @path is NULL.
+ */
+void stats_print_json(FILE *f, const char *path, const struct conv_stats *st,
+		      double wall)
+{
+	int i;
+
+	if (path) {
+		fputs("{\"file\":", f);
+		json_string(f, path);
+	} else {
+		fprintf(f, "{\"total\":true,\"files\":%ld,\"wall_s\":%.6f",
+			st->files, wall);
+	}
+
+	for (i = path ? STATS_PARSE : 0; i < NR_STATS_TIMERS; i++)
+		fprintf(f, ",\"%s_s\":%.6f", timer_names[i], st->seconds[i]);
+
+	fprintf(f, ",\"cues\":%ld,\"lines\":%ld,\"nodes\":%ld,\"tokens\":%ld,"
+		"\"bytes_read\":%lld,\"bytes_written\":%lld}\n", st->cues,
+		st->lines, st->nodes, st->tokens, st->bytes_read,
+		st->bytes_written);
+}
@@ -0,0 +1,330 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - utf8.c
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ *
+ * UTF-8 text handling on byte sequences. Subtitles and MeCab output are
+ * always UTF-8, so none of this depends on the locale.
+ *
+ * Character counting runs on every line and node, so on x86 it uses
+ * SSE2 or AVX2, picked at run time, with a scalar loop for the tail and
+ * for other architectures.
+ */
+
+#include "utf8.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UTF8_SIMD
+#include <immintrin.h>
+#endif
+
+static int is_continuation(unsigned char c)
+{
+	return (c & 0xC0) == 0x80;
+}
+
+/*
+ * Decode the character at the start of the @len bytes at @s into *@cp.
+ * Returns the number of bytes it takes, or 0 if @s is empty or does not
+ * start with a well-formed character.
+ */
+size_t utf8_decode(const char *s, size_t len, uint32_t *cp)
+{
+	const unsigned char *p = (const unsigned char *)s;
+	uint32_t c;
+	size_t n, i;
+
+	if (len == 0)
+		return 0;
+
+	if (p[0] < 0x80) {
+		*cp = p[0];
+		return 1;
+	} else if (p[0] >= 0xC2 && p[0] <= 0xDF) {
+		c = p[0] & 0x1F;
+		n = 2;
+	} else if (p[0] >= 0xE0 && p[0] <= 0xEF) {
+		c = p[0] & 0x0F;
+		n = 3;
+	} else if (p[0] >= 0xF0 && p[0] <= 0xF4) {
+		c = p[0] & 0x07;
+		n = 4;
+	} else {
+		return 0;
+	}
+
+	if (len < n)
+		return 0;
+
+	for (i = 1; i < n; i++) {
+		if (!is_continuation(p[i]))
+			return 0;
+		c = (c << 6) | (p[i] & 0x3F);
+	}
+
+	/* Overlong forms, surrogates and values past U+10FFFF */
+	if ((n == 3 && c < 0x800) || (n == 4 && c < 0x10000) ||
+	    (c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF)
+		return 0;
+
+	*cp = c;
+	return n;
+}
+
+/*
+ * Decode the last character of the @len bytes at @s. Returns the number
+ * of bytes it takes, or 0 as utf8_decode() does.
+ */
+size_t utf8_decode_last(const char *s, size_t len, uint32_t *cp)
+{
+	size_t start = len;
+
+	while (start > 0 && len - start < 4) {
+		start--;
+		if (!is_continuation((unsigned char)s[start]))
+			break;
+	}
+
+	if (utf8_decode(s + start, len - start, cp) != len - start)
+		return 0;
+	return len - start;
+}
+
+size_t utf8_count_scalar(const char *s, size_t len)
+{
+	size_t count = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		count += !is_continuation((unsigned char)s[i]);
+	return count;
+}
+
+#ifdef UTF8_SIMD
+/*
+ * As signed bytes, continuation bytes (0x80-0xBF) are exactly those
+ * below -64.
+ */
+__attribute__((target("sse2")))
+static size_t count_sse2(const char *s, size_t len)
+{
+	const __m128i limit = _mm_set1_epi8(-64);
+	size_t cont = 0;
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+
+		cont += __builtin_popcount(_mm_movemask_epi8(
+				_mm_cmpgt_epi8(limit, v)));
+	}
+	return i - cont + utf8_count_scalar(s + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t count_avx2(const char *s, size_t len)
+{
+	const __m256i limit = _mm256_set1_epi8(-64);
+	size_t cont = 0;
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+
+		cont += __builtin_popcount((unsigned int)_mm256_movemask_epi8(
+				_mm256_cmpgt_epi8(limit, v)));
+	}
+	return i - cont + count_sse2(s + i, len - i);
+}
+#endif
+
+/*
+ * Count the characters in the @len bytes at @s, that is every byte that
+ * is not a continuation byte.
+ */
+size_t utf8_count(const char *s, size_t len)
+{
+#ifdef UTF8_SIMD
+	if (len >= 32 && __builtin_cpu_supports("avx2"))
+		return count_avx2(s, len);
+	if (len >= 16 && __builtin_cpu_supports("sse2"))
+		return count_sse2(s, len);
+#endif
+	return utf8_count_scalar(s, len);
+}
+
+/*
+ * Kanji are encoded with lead bytes 0xE4-0xE9, or 0xE3 followed by
+ * 0x90-0xBF (Extension A below U+4000) or by 0x80 0x85-0x87 (iteration
+ * marks). The kernels below flag those byte patterns, then the first
+ * candidate is decoded to rule out the few non-kanji they also match.
+ */
+static int kanji_at(const char *s, size_t len, size_t i)
+{
+	uint32_t c;
+
+	return utf8_decode(s + i, len - i, &c) && utf8_is_kanji(c);
+}
+
+static int has_kanji_scalar(const char *s, size_t len, size_t i)
+{
+	for (; i + 2 < len; i++) {
+		const unsigned char *p = (const unsigned char *)s + i;
+
+		if (p[0] < 0xE3 || p[0] > 0xE9)
+			continue;
+		if (p[0] == 0xE3 && p[1] != 0x80 && p[1] < 0x90)
+			continue;
+		if (kanji_at(s, len, i))
+			return 1;
+	}
+	return 0;
+}
+
+#ifdef UTF8_SIMD
+/* Bytes of @v in [@lo, @lo + @span], as 0xFF */
+__attribute__((target("sse2")))
+static __m128i in_range_sse2(__m128i v, char lo, char span)
+{
+	__m128i x = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+
+	return _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(span)), x);
+}
+
+__attribute__((target("sse2")))
+static int has_kanji_sse2(const char *s, size_t len)
+{
+	const __m128i e3 = _mm_set1_epi8((char)0xE3);
+	const __m128i b80 = _mm_set1_epi8((char)0x80);
+	size_t i;
+
+	/* Two bytes of lookahead for the second and third byte checks */
+	for (i = 0; i + 18 <= len; i += 16) {
+		__m128i v0 = _mm_loadu_si128((const __m128i *)(s + i));
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(s + i + 1));
+		__m128i v2 = _mm_loadu_si128((const __m128i *)(s + i + 2));
+		__m128i lead3 = _mm_cmpeq_epi8(v0, e3);
+		__m128i hit;
+		unsigned int mask;
+
+		hit = in_range_sse2(v0, (char)0xE4, 0x05);
+		hit = _mm_or_si128(hit, _mm_and_si128(lead3,
+				in_range_sse2(v1, (char)0x90, 0x2F)));
+		hit = _mm_or_si128(hit, _mm_and_si128(
+				_mm_and_si128(lead3, _mm_cmpeq_epi8(v1, b80)),
+				in_range_sse2(v2, (char)0x85, 0x02)));
+
+		for (mask = _mm_movemask_epi8(hit); mask; mask &= mask - 1) {
+			if (kanji_at(s, len, i + __builtin_ctz(mask)))
+				return 1;
+		}
+	}
+	return has_kanji_scalar(s, len, i);
+}
+
+__attribute__((target("avx2")))
+static __m256i in_range_avx2(__m256i v, char lo, char span)
+{
+	__m256i x = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+
+	return _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(span)),
+				 x);
+}
+
+__attribute__((target("avx2")))
+static int has_kanji_avx2(const char *s, size_t len)
+{
+	const __m256i e3 = _mm256_set1_epi8((char)0xE3);
+	const __m256i b80 = _mm256_set1_epi8((char)0x80);
+	size_t i;
+
+	for (i = 0; i + 34 <= len; i += 32) {
+		__m256i v0 = _mm256_loadu_si256((const __m256i *)(s + i));
+		__m256i v1 = _mm256_loadu_si256((const __m256i *)(s + i + 1));
+		__m256i v2 = _mm256_loadu_si256((const __m256i *)(s + i + 2));
+		__m256i lead3 = _mm256_cmpeq_epi8(v0, e3);
+		__m256i hit;
+		unsigned int mask;
+
+		hit = in_range_avx2(v0, (char)0xE4, 0x05);
+		hit = _mm256_or_si256(hit, _mm256_and_si256(lead3,
+				in_range_avx2(v1, (char)0x90, 0x2F)));
+		hit = _mm256_or_si256(hit, _mm256_and_si256(
+				_mm256_and_si256(lead3,
+						 _mm256_cmpeq_epi8(v1, b80)),
+				in_range_avx2(v2, (char)0x85, 0x02)));
+
+		mask = (unsigned int)_mm256_movemask_epi8(hit);
+		for (; mask; mask &= mask - 1) {
+			if (kanji_at(s, len, i + __builtin_ctz(mask)))
+				return 1;
+		}
+	}
+	return has_kanji_scalar(s, len, i);
+}
+#endif
+
+/*
+ * Check whether the @len bytes at @s contain a character for which
+ * utf8_is_kanji() holds, without decoding the rest.
+ */
+int utf8_has_kanji(const char *s, size_t len)
+{
+#ifdef UTF8_SIMD
+	if (len >= 34 && __builtin_cpu_supports("avx2"))
+		return has_kanji_avx2(s, len);
+	if (len >= 18 && __builtin_cpu_supports("sse2"))
+		return has_kanji_sse2(s, len);
+#endif
+	return has_kanji_scalar(s, len, 0);
+}
+
+int utf8_is_kanji(uint32_t c)
+{
+	/* CJK Unified Ideographs */
+	if (c >= 0x4E00 && c <= 0x9FAF)
+		return 1;
+	/* CJK Extension A */
+	if (c >= 0x3400 && c <= 0x4DBF)
+		return 1;
+	/* Ideographic iteration marks */
+	if (c >= 0x3005 && c <= 0x3007)
+		return 1;
+	return 0;
+}
+
+int utf8_is_hiragana(uint32_t c)
+{
+	return c >= 0x3040 && c <= 0x309F;
+}
+
+/* The range katakana_to_hiragana() maps, ァ (U+30A1) to ヺ (U+30FA) */
+int utf8_is_katakana(uint32_t c)
+{
+	return c >= 0x30A1 && c <= 0x30FA;
+}
+
+/*
+ * Rewrite the katakana in the @len bytes at @s as hiragana, in place.
+ * Both are three-byte sequences starting with 0xE3 and 0x60 apart, so
+ * only the last two bytes change.
+ */
+void utf8_katakana_to_hiragana(char *s, size_t len)
+{
+	unsigned char *p = (unsigned char *)s;
+	size_t i;
+
+	for (i = 0; i + 2 < len; i++) {
+		uint32_t c;
+
+		if (p[i] != 0xE3 || utf8_decode(s + i, len - i, &c) != 3)
+			continue;
+
+		if (utf8_is_katakana(c)) {
+			c -= 0x60;
+			p[i + 1] = 0x80 | ((c >> 6) & 0x3F);
+			p[i + 2] = 0x80 | (c & 0x3F);
+		}
+		i += 2;
+	}
+}
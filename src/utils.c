@@ -4,18 +4,17 @@
  * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <wchar.h>
-#include <dirent.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/stat.h>
-#include <mecab.h>
 
 #include "utils.h"
 #include "types.h"
-#include "srt.h"
-#include "ass.h"
 
 static struct font_config default_cfg = {
 	.font_name = "MS Gothic",
@@ -26,7 +25,8 @@ static struct font_config default_cfg = {
 	.baseline_y = 980,
 	.furigana_offset = 48,
 	.char_width = 52.0f,
-	.line_spacing = 104
+	.line_spacing = 104,
+	.packed_furigana = 0
 };
 
 struct font_config *get_default_config(void)
@@ -50,10 +50,28 @@ struct font_config *create_scaled_config(int main_size)
 	scaled_cfg.furigana_offset = (int)(48 * scale + 0.5f);
 	scaled_cfg.char_width = main_size;
 	scaled_cfg.line_spacing = (int)(104 * scale + 0.5f);
+	scaled_cfg.packed_furigana = default_cfg.packed_furigana;
 
 	return &scaled_cfg;
 }
 
+/*
+ * Hash every setting that affects the generated .ass.
+ */
+uint64_t config_hash(const struct font_config *cfg)
+{
+	int fields[] = {
+		cfg->main_size, cfg->furigana_size, cfg->screen_w,
+		cfg->screen_h, cfg->baseline_y, cfg->furigana_offset,
+		cfg->line_spacing, cfg->packed_furigana
+	};
+	uint64_t h;
+
+	h = hash_bytes(cfg->font_name, strlen(cfg->font_name) + 1, HASH_SEED);
+	h = hash_bytes(fields, sizeof(fields), h);
+	return hash_bytes(&cfg->char_width, sizeof(cfg->char_width), h);
+}
+
 void print_banner(void)
 {
 	printf("\n");
@@ -74,7 +92,7 @@ void print_banner(void)
 	printf("                    ⠛⠒⠛⠉⠉⠀⠀⠀⣴⠟⢃⡴⠛⠋⠀⠀⠀⠀⠀⠀⠀⠀⠀⠀⠀⠀⠀\n");
 	printf("                    ⠀⠀⠀⠀⠀⠀⠀⠀⠛⠛⠋⠁⠀⠀⠀⠀⠀⠀⠀⠀⠀⠀⠀⠀⠀⠀⠀\n");
 	printf("\n");
-	printf("                      (^_^) Version 1.1.0 (^_^)\n");
+	printf("                      (^_^) Version " JPSUB_VERSION " (^_^)\n");
 	printf("\n");
 	printf("  ════════════════════════════════════════════════════════════════\n");
 	printf("\n");
@@ -91,119 +109,151 @@ void print_banner(void)
 	printf("\n");
 }
 
-int count_unicode_chars(const char *s)
+static char *put_2digits(char *p, int v)
 {
-	mbstate_t st = {0};
-	int count = 0;
-	size_t len;
-	size_t i;
-
-	if (!s)
-		return 0;
-
-	len = strlen(s);
-	for (i = 0; i < len; ) {
-		wchar_t wc;
-		size_t n = mbrtowc(&wc, s + i, len - i, &st);
-
-		if (n == 0 || n == (size_t)-1 || n == (size_t)-2)
-			break;
-		count++;
-		i += n;
-	}
-	return count;
+	p[0] = '0' + v / 10;
+	p[1] = '0' + v % 10;
+	return p + 2;
 }
 
-void format_ass_time(int ms, char *buf)
+/*
+ * Format @ms as an ASS timestamp, H:MM:SS.cc, in @buf (MAX_TIME bytes).
+ * Returns its length.
+ */
+int format_ass_time(int ms, char *buf)
 {
+	char digits[16], *d = digits + sizeof(digits), *p = buf;
 	int h, m, s, cs;
 
 	h = ms / MS_PER_HOUR;
-	ms %= MS_PER_HOUR;
-	m = ms / MS_PER_MINUTE;
-	ms %= MS_PER_MINUTE;
-	s = ms / MS_PER_SECOND;
-	cs = (ms % MS_PER_SECOND) / 10;
-
-	snprintf(buf, MAX_TIME, "%d:%02d:%02d.%02d", h, m, s, cs);
+	m = ms % MS_PER_HOUR / MS_PER_MINUTE;
+	s = ms % MS_PER_MINUTE / MS_PER_SECOND;
+	cs = ms % MS_PER_SECOND / 10;
+
+	/* Only an overflowing timestamp is negative */
+	if (ms < 0)
+		return snprintf(buf, MAX_TIME, "%d:%02d:%02d.%02d",
+				h, m, s, cs);
+
+	do {
+		*--d = '0' + h % 10;
+		h /= 10;
+	} while (h);
+	while (d < digits + sizeof(digits))
+		*p++ = *d++;
+
+	*p++ = ':';
+	p = put_2digits(p, m);
+	*p++ = ':';
+	p = put_2digits(p, s);
+	*p++ = '.';
+	p = put_2digits(p, cs);
+	*p = '\0';
+	return p - buf;
 }
 
-int is_kanji(wchar_t c)
+/*
+ * FNV-1a over @len bytes, continuing from @h (HASH_SEED to start).
+ */
+uint64_t hash_bytes(const void *data, size_t len, uint64_t h)
 {
-	/* CJK Unified Ideographs */
-	if (c >= 0x4E00 && c <= 0x9FAF)
-		return 1;
-	/* CJK Extension A */
-	if (c >= 0x3400 && c <= 0x4DBF)
-		return 1;
-	/* Ideographic iteration marks */
-	if (c >= 0x3005 && c <= 0x3007)
-		return 1;
-	return 0;
+	const unsigned char *p = data;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
 }
 
-int ends_with_srt(const char *path)
+/*
+ * Hash the contents of @path. Returns -1 with errno set on failure.
+ */
+int hash_file(const char *path, uint64_t *hash)
 {
-	size_t len = strlen(path);
-
-	if (len <= 4)
-		return 0;
-	return strcmp(path + len - 4, ".srt") == 0;
+	char buf[65536];
+	uint64_t h = HASH_SEED;
+	size_t n;
+	FILE *f;
+	int ret;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return -1;
+
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		h = hash_bytes(buf, n, h);
+
+	ret = ferror(f) ? -1 : 0;
+	fclose(f);
+	*hash = h;
+	return ret;
 }
 
-void process_file(const char *path, struct font_config *cfg, mecab_t *mecab)
+double monotonic_seconds(void)
 {
-	struct subtitle *subs;
-	char outpath[JPSUB_MAX_PATH];
-	char *dot;
-	int count = 0;
-	int i;
+	struct timespec ts;
 
-	subs = parse_srt(path, &count);
-	if (!subs)
-		return;
-
-	strncpy(outpath, path, sizeof(outpath) - 1);
-	outpath[sizeof(outpath) - 1] = '\0';
-
-	dot = strrchr(outpath, '.');
-	if (dot && strcmp(dot, ".srt") == 0)
-		*dot = '\0';
-
-	printf("Processing: %s (%d subtitles)\n", path, count);
-	generate_ass(outpath, subs, count, cfg, mecab);
-
-	for (i = 0; i < count; i++)
-		free(subs[i].text);
-	free(subs);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-void scan_directory(const char *dir, struct font_config *cfg, mecab_t *mecab)
+static int ends_with(const char *path, const char *ext)
 {
-	DIR *d;
-	struct dirent *entry;
+	size_t len = strlen(path), n = strlen(ext);
 
-	d = opendir(dir);
-	if (!d)
-		return;
+	if (len <= n)
+		return 0;
+	return strcmp(path + len - n, ext) == 0;
+}
 
-	while ((entry = readdir(d)) != NULL) {
-		char path[JPSUB_MAX_PATH];
-		struct stat st;
+int ends_with_srt(const char *path)
+{
+	return ends_with(path, ".srt");
+}
 
-		if (entry->d_name[0] == '.')
-			continue;
+int ends_with_mkv(const char *path)
+{
+	return ends_with(path, ".mkv");
+}
 
-		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+/*
+ * Check whether @path is a zip or tar archive, possibly compressed.
+ */
+int is_archive(const char *path)
+{
+	return ends_with(path, ".zip") || ends_with(path, ".tar") ||
+	       ends_with(path, ".tar.gz") || ends_with(path, ".tgz");
+}
 
-		if (stat(path, &st) != 0)
-			continue;
+/*
+ * Check whether @path is something subtitles are read from: an SRT file,
+ * a Matroska file with an SRT track or an archive of SRT files.
+ */
+int is_subtitle_input(const char *path)
+{
+	return ends_with_srt(path) || ends_with_mkv(path) || is_archive(path);
+}
 
-		if (S_ISDIR(st.st_mode))
-			scan_directory(path, cfg, mecab);
-		else if (ends_with_srt(path))
-			process_file(path, cfg, mecab);
+/*
+ * Create the missing folders leading to the file at @path. Returns -1
+ * with errno set on failure.
+ */
+int make_parent_dirs(const char *path)
+{
+	char *buf, *p;
+	int ret = 0;
+
+	buf = strdup(path);
+	if (!buf)
+		return -1;
+
+	for (p = strchr(buf + 1, '/'); p && ret == 0; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		if (mkdir(buf, 0777) < 0 && errno != EEXIST)
+			ret = -1;
+		*p = '/';
 	}
-
-	closedir(d);
+	free(buf);
+	return ret;
 }
@@ -0,0 +1,302 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Furigana4subtitles - walk.c
+ * Copyright (C) 2026 Rémi SIMAER <rsimaer@gmail.com>
+ *
+ * Finds the subtitle inputs below a folder with several threads sharing
+ * a stack of directories to read. Directories are opened relative to
+ * their parent and entries are only stat'ed when readdir() cannot tell
+ * their type or when they are inputs, whose size and mtime the batch
+ * needs. Paths are built on the heap, so there is no limit on their
+ * length or on the depth of the tree.
+ *
+ * Symbolic links to files are followed, symbolic links to directories
+ * are not, so a link cycle cannot make the walk endless.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE		/* d_type */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "walk.h"
+#include "types.h"
+#include "utils.h"
+
+/*
+ * Directory waiting to be read. Its fd is opened relative to its parent
+ * while few directories are queued, and from its path beyond that.
+ */
+struct walk_dir {
+	struct walk_dir *next;
+	char *path;
+	size_t len;
+	int fd;
+};
+
+struct walker {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	struct walk_dir *stack;
+	int busy;		/* threads reading a directory */
+	int open_fds;		/* fds held by queued directories */
+	walk_fn fn;
+	void *data;
+	struct walk_stats *stats;
+};
+
+struct walk_thread {
+	pthread_t thread;
+	struct walker *w;
+	char *buf;		/* path of the current file */
+	size_t cap;
+	struct walk_stats stats;
+};
+
+static char *join_path(const char *dir, size_t dlen, const char *name,
+		       char **buf, size_t *cap)
+{
+	size_t need = dlen + strlen(name) + 2;
+
+	if (need > *cap) {
+		char *tmp = realloc(*buf, need);
+
+		if (!tmp)
+			return NULL;
+		*buf = tmp;
+		*cap = need;
+	}
+
+	memcpy(*buf, dir, dlen);
+	(*buf)[dlen] = '/';
+	strcpy(*buf + dlen + 1, name);
+	return *buf;
+}
+
+static void push_dir(struct walker *w, struct walk_dir *d)
+{
+	pthread_mutex_lock(&w->lock);
+	d->next = w->stack;
+	w->stack = d;
+	pthread_cond_signal(&w->changed);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/*
+ * Queue the subdirectory @name of the directory open at @dirfd.
+ */
+static void queue_subdir(struct walker *w, int dirfd,
+			 const struct walk_dir *parent, const char *name)
+{
+	struct walk_dir *d;
+	size_t cap = 0;
+	int use_fd;
+
+	d = malloc(sizeof(*d));
+	if (!d)
+		return;
+
+	d->path = NULL;
+	if (!join_path(parent->path, parent->len, name, &d->path, &cap)) {
+		free(d);
+		return;
+	}
+	d->len = strlen(d->path);
+
+	pthread_mutex_lock(&w->lock);
+	use_fd = w->open_fds < WALK_OPEN_DIRS;
+	if (use_fd)
+		w->open_fds++;
+	pthread_mutex_unlock(&w->lock);
+
+	d->fd = -1;
+	if (use_fd) {
+		d->fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY);
+		if (d->fd < 0) {
+			pthread_mutex_lock(&w->lock);
+			w->open_fds--;
+			pthread_mutex_unlock(&w->lock);
+		}
+	}
+	push_dir(w, d);
+}
+
+/*
+ * Read the directory @d, queueing its subdirectories and reporting its
+ * subtitle inputs.
+ */
+static void read_dir(struct walk_thread *t, struct walk_dir *d)
+{
+	struct walker *w = t->w;
+	struct dirent *e;
+	DIR *dir;
+	int fd;
+
+	fd = d->fd >= 0 ? d->fd : open(d->path, O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return;
+
+	dir = fdopendir(fd);
+	if (!dir) {
+		close(fd);
+		return;
+	}
+	t->stats.dirs++;
+
+	while ((e = readdir(dir)) != NULL) {
+		unsigned char type = e->d_type;
+		struct stat st;
+		int have_st = 0;
+
+		t->stats.entries++;
+		if (e->d_name[0] == '.')
+			continue;
+
+		if (type == DT_UNKNOWN) {
+			t->stats.stats++;
+			if (fstatat(fd, e->d_name, &st,
+				    AT_SYMLINK_NOFOLLOW) < 0)
+				continue;
+			if (S_ISDIR(st.st_mode))
+				type = DT_DIR;
+			else if (S_ISLNK(st.st_mode))
+				type = DT_LNK;
+			else if (S_ISREG(st.st_mode))
+				type = DT_REG;
+			have_st = S_ISREG(st.st_mode);
+		}
+
+		if (type == DT_DIR) {
+			queue_subdir(w, fd, d, e->d_name);
+			continue;
+		}
+
+		if ((type != DT_REG && type != DT_LNK) ||
+		    !is_subtitle_input(e->d_name))
+			continue;
+
+		if (!have_st) {
+			t->stats.stats++;
+			if (fstatat(fd, e->d_name, &st, 0) < 0)
+				continue;
+		}
+		if (!S_ISREG(st.st_mode))
+			continue;
+
+		if (!join_path(d->path, d->len, e->d_name, &t->buf, &t->cap))
+			continue;
+		t->stats.files++;
+		w->fn(t->buf, &st, w->data);
+	}
+
+	closedir(dir);
+}
+
+static void *walk_thread_main(void *arg)
+{
+	struct walk_thread *t = arg;
+	struct walker *w = t->w;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		struct walk_dir *d;
+
+		while (!w->stack && w->busy)
+			pthread_cond_wait(&w->changed, &w->lock);
+		if (!w->stack)
+			break;
+
+		d = w->stack;
+		w->stack = d->next;
+		if (d->fd >= 0)
+			w->open_fds--;
+		w->busy++;
+		pthread_mutex_unlock(&w->lock);
+
+		read_dir(t, d);
+		free(d->path);
+		free(d);
+
+		pthread_mutex_lock(&w->lock);
+		w->busy--;
+		if (!w->stack && !w->busy)
+			pthread_cond_broadcast(&w->changed);
+	}
+
+	w->stats->dirs += t->stats.dirs;
+	w->stats->entries += t->stats.entries;
+	w->stats->stats += t->stats.stats;
+	w->stats->files += t->stats.files;
+	pthread_mutex_unlock(&w->lock);
+
+	free(t->buf);
+	return NULL;
+}
+
+/*
+ * Call @fn for every subtitle input below the directory @root, reading
+ * directories on @nthreads threads. Files are found in no particular
+ * order.
+ */
+void walk_tree(const char *root, int nthreads, walk_fn fn, void *data,
+	       struct walk_stats *stats)
+{
+	struct walker w;
+	struct walk_thread *t;
+	struct walk_dir *d;
+	double start = monotonic_seconds();
+	int started;
+	int i;
+
+	if (nthreads < 1)
+		nthreads = 1;
+
+	d = malloc(sizeof(*d));
+	t = calloc(nthreads, sizeof(struct walk_thread));
+	if (!d || !t || !(d->path = strdup(root))) {
+		free(d);
+		free(t);
+		return;
+	}
+	d->len = strlen(root);
+	d->fd = -1;
+	d->next = NULL;
+
+	memset(&w, 0, sizeof(w));
+	pthread_mutex_init(&w.lock, NULL);
+	pthread_cond_init(&w.changed, NULL);
+	w.stack = d;
+	w.fn = fn;
+	w.data = data;
+	w.stats = stats;
+
+	for (started = 0; started < nthreads; started++) {
+		t[started].w = &w;
+		if (pthread_create(&t[started].thread, NULL, walk_thread_main,
+				   &t[started]) != 0)
+			break;
+	}
+
+	/* Without any thread, walk on the calling one */
+	if (started == 0) {
+		t[0].w = &w;
+		walk_thread_main(&t[0]);
+	}
+
+	for (i = 0; i < started; i++)
+		pthread_join(t[i].thread, NULL);
+
+	pthread_cond_destroy(&w.changed);
+	pthread_mutex_destroy(&w.lock);
+	free(t);
+
+	stats->seconds += monotonic_seconds() - start;
+}